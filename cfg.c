@@ -0,0 +1,252 @@
+/*    cfg.c
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of cfg.[h|c] is to hold the settings of a config file,
+ * parsed once. See cfg.h.
+ * */
+
+#include "cfg.h"
+
+/* Stores made by cfg_getparameter(), by path, so each file is read
+ * once a run. */
+static hash_t *cfg_files;
+static pthread_mutex_t cfg_filelock = PTHREAD_MUTEX_INITIALIZER;
+
+static hash_t
+*parse(const char *path, int fatal);
+static char
+*trim(char *s);
+static void
+freeval(void *v);
+static void
+cfgerr(const char *path, size_t lineno, const char *msg, int fatal);
+
+cfg_t
+*cfg_load(const char *progname, const char *fn)
+{ /* Read $HOME/.config/progname/fn. A missing file gives an empty
+   * store, so every lookup gets its default. A malformed line is fatal.
+*/
+	cfg_t *cfg = xmalloc(sizeof(cfg_t));
+	memset(cfg, 0, sizeof(cfg_t));
+	char path[PATH_MAX];
+	snprintf(path, PATH_MAX, "%s/.config/%s/%s", getenv("HOME"),
+				progname, fn);
+	cfg->path = xstrdup(path);
+	cfg->vals = parse(cfg->path, 1);
+	cfg->gen = 1;
+	pthread_rwlock_init(&cfg->lock, NULL);
+	return cfg;
+} // cfg_load()
+
+int
+cfg_reload(cfg_t *cfg)
+{ /* Read the config file again and replace the values at once. If it
+   * has a malformed line that is reported, the old values are kept and
+   * -1 returned, so a daemon is not killed by a slip in an edit.
+   * Returns 0 on success.
+*/
+	hash_t *vals = parse(cfg->path, 0);
+	if (!vals) return -1;
+	pthread_rwlock_wrlock(&cfg->lock);
+	hash_t *old = cfg->vals;
+	cfg->vals = vals;
+	cfg->gen++;
+	pthread_rwlock_unlock(&cfg->lock);
+	free_hash(old, freeval);
+	return 0;
+} // cfg_reload()
+
+void
+free_cfg(cfg_t *cfg)
+{ /* free resources allocated by cfg_load() */
+	free_hash(cfg->vals, freeval);
+	pthread_rwlock_destroy(&cfg->lock);
+	free(cfg->path);
+	free(cfg);
+} // free_cfg()
+
+int
+cfg_getstr(cfg_t *cfg, const char *name, char *buf, size_t size)
+{ /* Copy the value of name into buf, of size bytes, cutting it short if
+   * need be. Returns 1 if name is set, 0 if not and buf is untouched.
+*/
+	pthread_rwlock_rdlock(&cfg->lock);
+	cfg_val *v = hash_get(cfg->vals, name);
+	if (v) snprintf(buf, size, "%s", v->str);
+	pthread_rwlock_unlock(&cfg->lock);
+	return v != NULL;
+} // cfg_getstr()
+
+char
+*cfg_dupstr(cfg_t *cfg, const char *name)
+{ /* Return a copy of the value of name on the heap, NULL if not set. */
+	pthread_rwlock_rdlock(&cfg->lock);
+	cfg_val *v = hash_get(cfg->vals, name);
+	char *ret = (v) ? xstrdup(v->str) : NULL;
+	pthread_rwlock_unlock(&cfg->lock);
+	return ret;
+} // cfg_dupstr()
+
+int
+cfg_trynum(cfg_t *cfg, const char *name, long long *num)
+{ /* Put the number name is set to in num and return 1. Returns 0 if name
+   * is not set and -1 if it is not a number, num is untouched either
+   * way. For callers such as a reload that must not die of a bad edit.
+*/
+	pthread_rwlock_rdlock(&cfg->lock);
+	cfg_val *v = hash_get(cfg->vals, name);
+	int ret = 0;
+	if (v) ret = (v->isnum) ? 1 : -1;
+	if (ret == 1) *num = v->num;
+	pthread_rwlock_unlock(&cfg->lock);
+	return ret;
+} // cfg_trynum()
+
+long long
+cfg_getnum(cfg_t *cfg, const char *name, long long dflt)
+{ /* Return the number name is set to, dflt if it is not set. A value
+   * that is not a number is fatal.
+*/
+	long long ret = dflt;
+	if (cfg_trynum(cfg, name, &ret) == -1) {
+		fprintf(stderr, "%s: %s is not a number.\n", cfg->path, name);
+		exit(EXIT_FAILURE);
+	}
+	return ret;
+} // cfg_getnum()
+
+int
+cfg_getbool(cfg_t *cfg, const char *name, int dflt)
+{ /* Return 1 or 0 for what name is set to, dflt if it is not set. A
+   * value that is not yes, no, true, false, on, off, 1 or 0 is fatal.
+*/
+	pthread_rwlock_rdlock(&cfg->lock);
+	cfg_val *v = hash_get(cfg->vals, name);
+	int ret = dflt;
+	int bad = (v && !v->isbool);
+	if (v && v->isbool) ret = v->num;
+	pthread_rwlock_unlock(&cfg->lock);
+	if (bad) {
+		fprintf(stderr, "%s: %s must be yes or no.\n", cfg->path, name);
+		exit(EXIT_FAILURE);
+	}
+	return ret;
+} // cfg_getbool()
+
+char
+*cfg_getparameter(const char *prn, const char *fn, const char *param)
+{ /* Return a copy on the heap of the value of param in the config file
+   * $HOME/.config/prn/fn. The file is only read the first time it is
+   * asked about. A missing param is fatal.
+*/
+	char key[PATH_MAX];
+	snprintf(key, PATH_MAX, "%s/%s", prn, fn);
+	pthread_mutex_lock(&cfg_filelock);
+	if (!cfg_files) cfg_files = init_hash(8);
+	cfg_t *cfg = hash_get(cfg_files, key);
+	if (!cfg) {
+		cfg = cfg_load(prn, fn);
+		hash_put(cfg_files, key, cfg);
+	}
+	pthread_mutex_unlock(&cfg_filelock);
+	char *ret = cfg_dupstr(cfg, param);
+	if (!ret) {
+		fprintf(stderr, "No such parameter: %s\n", param);
+		exit(EXIT_FAILURE);
+	}
+	return ret;
+} // cfg_getparameter()
+
+static hash_t
+*parse(const char *path, int fatal)
+{ /* Read and parse the config file path into a new hash. A missing
+   * file gives an empty one. Returns NULL on a malformed line unless
+   * fatal is set, when it aborts instead.
+*/
+	hash_t *vals = init_hash(16);
+	mdata *md = readfile(path, 0, 1);	// the extra byte ends the text.
+	if (!md) return vals;
+	char *line = md->fro;
+	size_t lineno = 0;
+	while (line && *line) {
+		lineno++;
+		char *next = strchr(line, '\n');
+		if (next) *next++ = 0;
+		char *name = trim(line);
+		line = next;
+		if (!*name || *name == '#') continue;
+		char *eq = strchr(name, '=');
+		if (!eq || eq == name) {
+			cfgerr(path, lineno, "expected name = value", fatal);
+			free_hash(vals, freeval);
+			free_mdata(md);
+			return NULL;
+		}
+		*eq = 0;
+		name = trim(name);
+		char *value = trim(eq + 1);
+		cfg_val *v = xmalloc(sizeof(cfg_val));
+		memset(v, 0, sizeof(cfg_val));
+		v->str = xstrdup(value);
+		char *end;
+		errno = 0;
+		v->num = strtoll(value, &end, 0);
+		v->isnum = (*value && !*end && !errno);
+		if (strcmp(value, "1") == 0 || strcasecmp(value, "yes") == 0 ||
+			strcasecmp(value, "true") == 0 || strcasecmp(value, "on") == 0) {
+			v->isbool = 1;
+			v->num = 1;
+		} else if (strcmp(value, "0") == 0 || strcasecmp(value, "no") == 0
+			|| strcasecmp(value, "false") == 0
+			|| strcasecmp(value, "off") == 0) {
+			v->isbool = 1;
+			v->num = 0;
+		}
+		freeval(hash_put(vals, name, v));	// the last one counts.
+	}
+	free_mdata(md);
+	return vals;
+} // parse()
+
+static char
+*trim(char *s)
+{ /* Cut white space off the end of s in place, and return where s
+   * starts after any leading white space.
+*/
+	while (isspace((unsigned char)*s)) s++;
+	size_t len = strlen(s);
+	while (len && isspace((unsigned char)s[len - 1])) s[--len] = 0;
+	return s;
+} // trim()
+
+static void
+freeval(void *v)
+{ /* free a cfg_val, may be NULL */
+	if (!v) return;
+	free(((cfg_val *)v)->str);
+	free(v);
+} // freeval()
+
+static void
+cfgerr(const char *path, size_t lineno, const char *msg, int fatal)
+{ /* Report a malformed line, fatally if fatal is set. */
+	fprintf(stderr, "%s:%lu: %s\n", path, lineno, msg);
+	if (fatal) exit(EXIT_FAILURE);
+} // cfgerr()
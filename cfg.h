@@ -0,0 +1,86 @@
+/*    cfg.h
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of cfg.[h|c] is to hold the settings of a config file,
+ * $HOME/.config/progname/file, read and parsed once into a hash of
+ * typed values. Lines are 'name = value', blank lines and lines that
+ * begin with '#' are ignored. Lookups copy the value out under a read
+ * lock, so a store may be shared by threads and reloaded, eg on SIGHUP,
+ * while in use.
+ * */
+
+#ifndef _CFG_H
+#define _CFG_H
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include "str.h"
+#include "files.h"
+#include "hash.h"
+
+typedef struct cfg_val {	// one setting, typed when read.
+	char *str;			// as written, trimmed.
+	int isnum;			// num holds str as a number.
+	long long num;
+	int isbool;			// num is 1 or 0 for yes/no, true/false, on/off.
+} cfg_val;
+
+typedef struct cfg_t {
+	char *path;			// of the config file.
+	hash_t *vals;		// name -> cfg_val.
+	pthread_rwlock_t lock;
+	unsigned long gen;	// how many times it has been loaded.
+} cfg_t;
+
+cfg_t
+*cfg_load(const char *progname, const char *fn);
+
+int
+cfg_reload(cfg_t *cfg);
+
+void
+free_cfg(cfg_t *cfg);
+
+int
+cfg_getstr(cfg_t *cfg, const char *name, char *buf, size_t size);
+
+char
+*cfg_dupstr(cfg_t *cfg, const char *name);
+
+int
+cfg_trynum(cfg_t *cfg, const char *name, long long *num);
+
+long long
+cfg_getnum(cfg_t *cfg, const char *name, long long dflt);
+
+int
+cfg_getbool(cfg_t *cfg, const char *name, int dflt);
+
+char
+*cfg_getparameter(const char *prn, const char *fn, const char *param);
+
+#endif
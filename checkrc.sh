@@ -0,0 +1,36 @@
+#!/bin/sh
+# checkrc.sh, run by 'make check' with the csmanager to test.
+#
+# Link a small home into two cloud targets, delete a source dir and
+# check that --reconcile removes its files and the emptied dir from
+# both targets. Exits non zero if it doesn't.
+
+cs=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+home=$(mktemp -d "${TMPDIR:-/tmp}/checkrc.XXXXXX") || exit 1
+trap 'rm -rf "$home"' EXIT
+mkdir -p "$home/A" "$home/B" "$home/Docs/sub" "$home/.config"
+for i in 1 2 3; do
+	echo $i > "$home/Docs/sub/f$i"
+	echo $i > "$home/Docs/g$i"
+done
+cd "$home" || exit 1
+HOME=$home "$cs" -c A,B > /dev/null || exit 1
+rm -r Docs/sub
+out=$(HOME=$home "$cs" -r -c A,B) || exit 1
+fail=0
+for t in A B; do
+	if [ -e $t/Docs/sub ]; then
+		echo "FAIL reconcile: $t/Docs/sub is still there"
+		fail=1
+	fi
+	if [ ! -f $t/Docs/g1 ]; then
+		echo "FAIL reconcile: $t/Docs/g1 was removed"
+		fail=1
+	fi
+done
+case $out in
+	*"Orphans removed: 6, bytes: 12, empty dirs removed: 2"*) ;;
+	*) echo "FAIL reconcile: $(echo "$out" | tail -n 1)"; fail=1;;
+esac
+[ $fail = 0 ] && echo "PASS reconcile two targets"
+exit $fail
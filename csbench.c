@@ -0,0 +1,369 @@
+/*    csbench.c
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of csbench is to time the phases of a csmanager run,
+ * finding the dirs, reading the trees and linking them, on a synthetic
+ * home dir so that one build can be compared with another. The tree is
+ * made from a seed so the same arguments always give the same tree.
+ * Results are written as JSON. Run by 'make bench'.
+ * */
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <getopt.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <errno.h>
+#include "str.h"
+#include "dirs.h"
+#include "files.h"
+#include "linker.h"
+#include "manifest.h"
+#include "ops.h"
+
+typedef struct bench_t {
+	int depth;			// levels of dirs below each top level dir.
+	int fanout;			// sub-dirs per dir.
+	int files;			// files per dir.
+	int dotpct;			// percentage of top level dirs that are dot dirs.
+	unsigned long seed;
+	int threads;		// for recursedir_mt() and pipelist().
+	int keep;			// leave the tree behind.
+	char *root;			// the scratch dir is made under it.
+	char scratch[PATH_MAX];	// made by mkdtemp(), the home dir is in it.
+	char *out;			// JSON goes here, NULL for stdout.
+	uint64_t rng;
+	size_t ndirs, nfiles;
+} bench_t;
+
+static void
+benchopts(int argc, char **argv, bench_t *b);
+static void
+benchhelp(int forced);
+static void
+maketree(bench_t *b, char *path, int level);
+static uint64_t
+nextrand(bench_t *b);
+static double
+now(void);
+static double
+timelink(oper_t *ops, char **vis, char **dots, size_t *nlinks);
+static double
+timepipe(oper_t *ops, excl_t *excl, int threads, size_t *nlinks);
+static oper_t
+*benchops(const char *home, manifest *mf);
+static void
+freeops(oper_t *ops);
+
+int main(int argc, char **argv)
+{
+	bench_t b;
+	benchopts(argc, argv, &b);
+	/* Only a dir of our own is ever removed, never the -r dir itself or
+	 * anything already in it. */
+	if (snprintf(b.scratch, PATH_MAX, "%s/csbench.XXXXXX", b.root)
+		>= PATH_MAX) {
+		fprintf(stderr, "Path too long: %s\n", b.root);
+		exit(EXIT_FAILURE);
+	}
+	if (!mkdtemp(b.scratch)) {
+		perror(b.scratch);
+		exit(EXIT_FAILURE);
+	}
+	char home[PATH_MAX];
+	strcpy(home, b.scratch);
+	strjoin(home, '/', "home", PATH_MAX);
+	newdir(home, 0);
+	setenv("HOME", home, 1);	// keep excl.lst and manifest in here.
+	double t = now();
+	char path[PATH_MAX];
+	strcpy(path, home);
+	maketree(&b, path, 0);
+	double tgen = now() - t;
+	strcpy(path, home);
+	strjoin(path, '/', "Nextcloud", PATH_MAX);
+	newdir(path, 0);
+	strcpy(path, home);
+	strjoin(path, '/', ".config", PATH_MAX);	// excl_list() needs it.
+	newdir(path, 1);
+
+	excl_t *excl = excl_list("csmanager");
+	t = now();
+	char **vis = gen_dirslist(home, 0, excl);
+	char **dots = gen_dirslist(home, 1, excl);
+	double tlist = now() - t;
+
+	rd_data *rd = init_recursedir(excl, 1024 * 1024, DT_DIR, DT_REG, 0);
+	sarena *sa = init_sarena(rd->meminc);
+	t = now();
+	recursedir(home, sa, rd);
+	double trd = now() - t;
+	size_t nrecs = sa->count;
+	free_recursedir(rd, sa);
+	rd = init_recursedir(excl, 1024 * 1024, DT_DIR, DT_REG, 0);
+	rd->nthreads = b.threads;
+	sa = init_sarena(rd->meminc);
+	t = now();
+	recursedir_mt(home, sa, rd);
+	double trdmt = now() - t;
+	free_recursedir(rd, sa);
+
+	size_t nlinks, n;
+	oper_t *ops = benchops(home, NULL);
+	double tcold = timelink(ops, vis, dots, &nlinks);
+	double twarm = timelink(ops, vis, dots, &n);
+	freeops(ops);
+	manifest *mf = load_manifest("csbench");
+	ops = benchops(home, mf);
+	double tmfbuild = timelink(ops, vis, dots, &n);
+	double tmf = timelink(ops, vis, dots, &n);
+	freeops(ops);
+	free_manifest(mf);
+	strcpy(path, home);	// a cold run again, pipelined.
+	strjoin(path, '/', "Nextcloud", PATH_MAX);
+	rmtree(path);
+	newdir(path, 0);
+	size_t npipe;
+	ops = benchops(home, NULL);
+	double tpipe = timepipe(ops, excl, b.threads, &npipe);
+	freeops(ops);
+
+	FILE *fpo = (b.out) ? dofopen(b.out, "w") : stdout;
+	fprintf(fpo, "{\n"
+		"  \"params\": {\"depth\": %d, \"fanout\": %d, \"files\": %d, "
+		"\"dotpct\": %d, \"seed\": %lu, \"threads\": %d},\n"
+		"  \"tree\": {\"dirs\": %lu, \"files\": %lu},\n"
+		"  \"counts\": {\"recursedir\": %lu, \"links\": %lu, "
+		"\"links_pipeline\": %lu},\n"
+		"  \"seconds\": {\n"
+		"    \"generate\": %.6f,\n"
+		"    \"gen_dirslist\": %.6f,\n"
+		"    \"recursedir\": %.6f,\n"
+		"    \"recursedir_mt\": %.6f,\n"
+		"    \"link_cold\": %.6f,\n"
+		"    \"link_warm\": %.6f,\n"
+		"    \"link_manifest_first\": %.6f,\n"
+		"    \"link_manifest\": %.6f,\n"
+		"    \"link_pipeline\": %.6f\n"
+		"  }\n"
+		"}\n", b.depth, b.fanout, b.files, b.dotpct, b.seed, b.threads,
+		b.ndirs, b.nfiles, nrecs, nlinks, npipe, tgen, tlist, trd, trdmt,
+		tcold, twarm, tmfbuild, tmf, tpipe);
+	if (b.out) dofclose(fpo);
+	if (b.keep) {
+		fprintf(stderr, "Tree kept in %s\n", b.scratch);
+	} else {
+		rmtree(b.scratch);
+	}
+	return 0;
+} // main()
+
+static void
+benchopts(int argc, char **argv, bench_t *b)
+{ /* Defaults, then the command line. */
+	memset(b, 0, sizeof(bench_t));
+	b->depth = 3;
+	b->fanout = 4;
+	b->files = 20;
+	b->dotpct = 20;
+	b->seed = 1;
+	b->threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int c;
+	while ((c = getopt(argc, argv, ":hd:f:n:p:s:j:r:o:k")) != -1) {
+		switch (c) {
+		case 'h':
+			benchhelp(0);
+			break;
+		case 'd':
+			b->depth = strtol(optarg, NULL, 10);
+			break;
+		case 'f':
+			b->fanout = strtol(optarg, NULL, 10);
+			break;
+		case 'n':
+			b->files = strtol(optarg, NULL, 10);
+			break;
+		case 'p':
+			b->dotpct = strtol(optarg, NULL, 10);
+			break;
+		case 's':
+			b->seed = strtoul(optarg, NULL, 10);
+			break;
+		case 'j':
+			b->threads = strtol(optarg, NULL, 10);
+			break;
+		case 'r':
+			b->root = xstrdup(optarg);
+			break;
+		case 'o':
+			b->out = xstrdup(optarg);
+			break;
+		case 'k':
+			b->keep = 1;
+			break;
+		case ':':
+			fprintf(stderr, "Option -%c requires an argument\n", optopt);
+			benchhelp(1);
+			break;
+		default:
+			fprintf(stderr, "Unknown option: -%c\n", optopt);
+			benchhelp(1);
+			break;
+		}
+	}
+	if (b->depth < 0 || b->fanout < 1 || b->files < 0 || b->dotpct < 0
+		|| b->dotpct > 100 || b->threads < 1) benchhelp(1);
+	if (!b->root) b->root = xstrdup("/tmp");
+	b->rng = b->seed * 0x9E3779B97F4A7C15ULL + 1;
+} // benchopts()
+
+static void
+benchhelp(int forced)
+{ /* Usage, exits. */
+	fputs("Usage: csbench [-d depth] [-f fanout] [-n files] [-p dotpct]"
+		" [-s seed]\n\t[-j threads] [-r scratch_dir] [-o out.json] [-k]\n"
+		"Makes a new dir, csbench.XXXXXX, in scratch_dir, default /tmp,"
+		" and a home\ndir in that with fanout top level dirs, dotpct "
+		"percent of them dot dirs,\neach depth levels deep with fanout "
+		"sub-dirs and files files per dir. Then\ntimes the phases of a "
+		"run on it and writes the times as JSON. The new dir\nis removed "
+		"unless -k is given, scratch_dir and what else is in it are\n"
+		"never touched.\n",
+		(forced) ? stderr : stdout);
+	exit(forced ? EXIT_FAILURE : EXIT_SUCCESS);
+} // benchhelp()
+
+static void
+maketree(bench_t *b, char *path, int level)
+{ /* Fill the dir path with files and, unless level is the last, with
+   * sub-dirs, recursively. Path is extended and restored in place.
+*/
+	size_t plen = strlen(path);
+	int i;
+	if (level) {	// no loose files in the home dir itself.
+		for (i = 0; i < b->files; i++) {
+			char name[32];
+			sprintf(name, "f%04d", i);
+			pathjoin(path, plen, name);
+			FILE *fpo = dofopen(path, "w");
+			size_t size = nextrand(b) % 4096;
+			size_t j;
+			for (j = 0; j < size; j++) fputc('a' + j % 26, fpo);
+			dofclose(fpo);
+			b->nfiles++;
+		}
+	}
+	if (level <= b->depth) {
+		for (i = 0; i < b->fanout; i++) {
+			char name[32];
+			int dot = (level == 0 && (int)(nextrand(b) % 100) < b->dotpct);
+			sprintf(name, "%sd%03d", (dot) ? "." : "", i);
+			pathjoin(path, plen, name);
+			newdir(path, 0);
+			b->ndirs++;
+			maketree(b, path, level + 1);
+		}
+	}
+	path[plen] = 0;
+} // maketree()
+
+static uint64_t
+nextrand(bench_t *b)
+{ /* xorshift64*, the same sequence for the same seed everywhere. */
+	b->rng ^= b->rng >> 12;
+	b->rng ^= b->rng << 25;
+	b->rng ^= b->rng >> 27;
+	return b->rng * 0x2545F4914F6CDD1DULL;
+} // nextrand()
+
+static double
+now(void)
+{ /* Monotonic time in seconds. */
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+} // now()
+
+static oper_t
+*benchops(const char *home, manifest *mf)
+{ /* What init_operations() would set up for home and the default
+   * target, without the command line.
+*/
+	oper_t *ops = xmalloc(sizeof(oper_t));
+	memset(ops, 0, sizeof(oper_t));
+	ops->dirname = xstrdup((char *)home);
+	ops->cloud_targets[0] = build_path(ops->dirname, "Nextcloud", NULL);
+	ops->dotdirs_dirs[0] = build_path(ops->cloud_targets[0], "Dotty", NULL);
+	ops->ntargets = 1;
+	ops->len2target = strlen(home);
+	ops->mf = mf;
+	ops->linker = init_linker(ops->cloud_targets, mf, 0);
+	ops->quiet = 1;
+	return ops;
+} // benchops()
+
+static void
+freeops(oper_t *ops)
+{ /* free resources allocated by benchops() */
+	free_linker(ops->linker);
+	free(ops->dirname);
+	free(ops->cloud_targets[0]);
+	free(ops->dotdirs_dirs[0]);
+	free(ops);
+	mkdirp_free();	// the next pass must find its dirs afresh.
+} // freeops()
+
+static double
+timelink(oper_t *ops, char **vis, char **dots, size_t *nlinks)
+{ /* Time processlist() over both lists, as a run does, and put the
+   * number of links made in nlinks.
+*/
+	size_t before = ops->linker->nlinks;
+	double t = now();
+	processlist(vis, ops, 0);
+	processlist(dots, ops, 1);
+	t = now() - t;
+	*nlinks = ops->linker->nlinks - before;
+	return t;
+} // timelink()
+
+static double
+timepipe(oper_t *ops, excl_t *excl, int threads, size_t *nlinks)
+{ /* Time pipelist() with threads link workers, finding the dirs as it
+   * goes, and put the number of links made in nlinks.
+*/
+	size_t before = ops->linker->nlinks;
+	ops->nthreads = threads;
+	ops->pipeline = 64;
+	char **dots;
+	double t = now();
+	char **vis = pipelist(ops, excl, 1, &dots);
+	t = now() - t;
+	destroystrarray(vis, 0);
+	destroystrarray(dots, 0);
+	*nlinks = ops->linker->nlinks - before;
+	return t;
+} // timepipe()
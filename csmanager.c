@@ -33,55 +33,97 @@
 #include <linux/limits.h>
 #include <libgen.h>
 #include <errno.h>
-// typdefs/structs here.
-typedef struct oper_t {
-	char *dirname;		// source dir to be synced.
-	char *filname;		// file listing source dirs to sync.
-	char *cloud_target;	// eg Dropbox or Nextcloud;
-	char *dotdirs_dir;	// the dir to send dot dir contents to.
-	char **excludes;	// list of dirs to exclude eg $HOME/Dropbox etc.
-	int do_master_dir;	// a dir, not a file listing dirs.
-	size_t len2target;	// byte count to (for example) $HOME/Nextcloud
-} oper_t;
 #include "str.h"
 #include "dirs.h"
 #include "files.h"
+#include "linker.h"
+#include "watch.h"
 #include "gopt.h"
+#include "ops.h"
+#include "reconcile.h"
 static oper_t
 *init_operations(char *srcdir, options_t *opts);
 static char
 *check_args(char **argv);
-static char
-**gen_dirslist(const char *dirname, int dotsornot, char **excl_list);
-static char
-**excl_list(const char *prname);
-static char
-**getfromfile(oper_t *ops);
 static void
-processlist(char **synclist, oper_t *ops, int dotsornot);
-static char
-*build_path(char *s1, char *s2, char *s3);
+startjournal(oper_t *ops, int resume);
+static void
+settargets(oper_t *ops, options_t *opts);
+static void
+dowatch(oper_t *ops, char **synclist, char **dotlist, excl_t *excl);
 
 int main(int argc, char **argv)
 {
 	options_t opts = process_options(argc, argv);	// options
+	if (opts.stats) st_start(opts.stats);
 	char *srcdir = check_args(argv);
 	oper_t *operations = init_operations(srcdir, &opts);
-	char **synclist;
-	if (operations->filname) { // work from list of dirs given.
+	char **synclist, **dotlist = NULL;
+	double t = st_now();
+	excl_t *excl = excl_list("csmanager");
+	st_phase("excl_list", t);
+	if (!operations->plan) startjournal(operations, opts.resume);
+	const char *sep = (operations->plan) ? "" : "====================\n";
+	if (operations->pipeline) {	// link the dirs while finding them.
+		if (!operations->filname) fputs(sep, stdout);
+		synclist = pipelist(operations, excl, !opts.dot_files, &dotlist);
+		if (!operations->filname) fputs(sep, stdout);
+		if (dotlist && opts.dot_files) {
+			tardotdirs(dotlist, operations, excl);
+			destroystrarray(dotlist, 0);
+			dotlist = NULL;
+			fputs(sep, stdout);
+		}
+	} else if (operations->filname) { // work from list of dirs given.
 		synclist = getfromfile(operations);
 		processlist(synclist, operations, 0);
 	} else { // work from source dir.
-		char **exlist = excl_list("csmanager");
-		printf("%s\n", "====================");
-		synclist = gen_dirslist(operations->dirname, 0, exlist);
+		fputs(sep, stdout);
+		t = st_now();
+		synclist = gen_dirslist(operations->dirname, 0, excl);
+		st_phase("gen_dirslist", t);
 		processlist(synclist, operations, 0);
-		printf("%s\n", "====================");
-		synclist = gen_dirslist(operations->dirname, 1, exlist);
-		processlist(synclist, operations, 1);
-		printf("%s\n", "====================");
+		fputs(sep, stdout);
+		t = st_now();
+		dotlist = gen_dirslist(operations->dirname, 1, excl);
+		st_phase("gen_dirslist", t);
+		if (opts.dot_files) {	// tarballs, nothing to link or watch.
+			tardotdirs(dotlist, operations, excl);
+			destroystrarray(dotlist, 0);
+			dotlist = NULL;
+		} else {
+			processlist(dotlist, operations, 1);
+		}
+		fputs(sep, stdout);
 	}
-
+	rc_data *rc = NULL;
+	size_t k;
+	if (opts.reconcile) {	// after linking so renames are known.
+		t = st_now();
+		rc = init_reconcile(operations->mf, operations->plan);
+		for (k = 0; k < operations->ntargets; k++) {
+			reconcile(rc, k, operations->dirname,
+					operations->cloud_targets[k],
+					operations->dotdirs_dirs[k]);
+			reconcile(rc, k, operations->dirname,
+					operations->dotdirs_dirs[k], NULL);
+		}
+		st_phase("reconcile", t);
+	}
+	linker_report(operations->linker);
+	if (rc) {	// pruned once, when every target has been walked.
+		reconcile_report(rc);
+		if (!operations->plan) rc_prune(rc);
+		free_reconcile(rc);
+	}
+	if (operations->plan) return 0;
+	t = st_now();
+	save_manifest(operations->mf);
+	st_phase("save_manifest", t);
+	close_journal(operations->jn, 1);	// nothing left to resume.
+	operations->jn = NULL;
+	operations->linker->skipino = 0;
+	if (operations->watch) dowatch(operations, synclist, dotlist, excl);
 
 	return 0;
 }//main()
@@ -107,59 +149,6 @@ char
 	return p;
 } // check_args()
 
-char
-**gen_dirslist(const char *dirname, int dotsornot, char **excl_list)
-{/* get the dir names under dirname selecting or avoiding dot dirs,
-  * then turn the data into an array of C strings.
-*/
-	mdata *md = init_mdata();
-	const size_t meminc = 1024 * 1024;	// 1 meg is ok for this job.
-	DIR *thedir = dopendir(dirname);
-	struct dirent *de;
-	while ((de = readdir(thedir))) {
-		if(strcmp("..", de->d_name) == 0) continue;
-		if(strcmp(".", de->d_name) == 0) continue;
-		if(de->d_type != DT_DIR) continue;
-		if (dotsornot) {
-			if (de->d_name[0] != '.') continue;
-		} else {
-			if (de->d_name[0] == '.') continue;
-		}
-		char buf[PATH_MAX];
-		strcpy(buf, dirname);
-		strjoin(buf, '/', de->d_name, PATH_MAX);
-		if(instrlist(buf, excl_list)) continue;
-		meminsert(buf, md, meminc);
-	}
-	doclosedir(thedir);
-	char **result = memblocktoarray(md, 0);
-	free_mdata(md);
-	return result;
-} // gen_dirslist()
-
-char
-**excl_list(const char *prname)
-{/* Return list of dirs to exclude from processing. If the excludes file
-  * does not exist, create it with some reasonable default values.
-*/
-	char fpath[PATH_MAX] = {0};
-	char *home = getenv("HOME");
-	sprintf(fpath, "%s/.config/%s/excl.lst", home, prname);
-	if (!exists_file(fpath))
-	{	// create it
-		char *cp = strstr(fpath, "excl.lst");
-		*cp = 0;	// does the dir exist? If not create it.
-		if (!exists_dir(fpath)) newdir(fpath, 0);
-		*cp = 'e';	// restore the filename to fpath.
-		FILE *fpo = dofopen(fpath, "w");
-		fprintf(fpo, "%s/%s\n", home, "Dropbox");
-		fprintf(fpo, "%s/%s\n", home, "Nextcloud");
-		dofclose(fpo);
-		sync();
-	}
-	return getfile_str(fpath);
-} // excl_list()
-
 oper_t
 *init_operations(char *srcdir, options_t *opts)
 { /* setup the variables to be operated on thru the run. */
@@ -172,34 +161,9 @@ oper_t
 		exit(EXIT_FAILURE);
 	}
 	operations->dirname = srcdir;
-	// Need to deal with target before anything else.
-	size_t len2target;
-	char wrkbuf[PATH_MAX];
-	char *stop;
-	if (opts->cloud_target) { // it's on the heap.
-		operations->cloud_target =
-				build_path(srcdir, opts->cloud_target, NULL);
-		strcpy(wrkbuf, operations->cloud_target);
-		stop = strstr(wrkbuf, opts->cloud_target);
-		free(opts->cloud_target);
-	} else { // use the default.
-		operations->cloud_target =
-						build_path(srcdir, "Nextcloud", NULL);
-		strcpy(wrkbuf, operations->cloud_target);
-		stop = strstr(wrkbuf, "Nextcloud");
-	}
-	*stop = '\0';
-	len2target = strlen(wrkbuf) - 1;	// backup to '/' before target.
-	operations->len2target = len2target;
-	// Now the dotfiles dir.
-	if (opts->dot_files_dir) {
-		operations->dotdirs_dir =
-		build_path(operations->cloud_target, opts->dot_files_dir, NULL);
-		free(opts->dot_files_dir);	// on the heap from options proc.
-	} else {
-		operations->dotdirs_dir =
-				build_path(operations->cloud_target, "Dotty", NULL);
-	}
+	// Need to deal with targets before anything else.
+	operations->len2target = strlen(srcdir);	// to the '/' before them.
+	settargets(operations, opts);
 	// deal with the source.
 	if (opts->dirs_from) {
 		operations->filname = build_path(srcdir, opts->dirs_from, NULL);
@@ -208,89 +172,160 @@ oper_t
 			exit(EXIT_FAILURE);
 		}
 	}
+	operations->watch = opts->watch;
+	operations->plan = opts->plan;
+	double t = st_now();
+	operations->cfg = cfg_load("csmanager", "csmanager.cfg");
+	st_phase("load_config", t);
+	operations->fixthreads = (opts->threads > 0);
+	operations->nthreads = (opts->threads > 0) ? opts->threads
+		: cfg_getnum(operations->cfg, "threads",
+						sysconf(_SC_NPROCESSORS_ONLN));
+	if (operations->nthreads < 1) {
+		fprintf(stderr, "%s: threads must be 1 or more.\n",
+				operations->cfg->path);
+		exit(EXIT_FAILURE);
+	}
+	t = st_now();
+	operations->mf = load_manifest("csmanager");
+	st_phase("load_manifest", t);
+	operations->linker =
+			init_linker(operations->cloud_targets, operations->mf, 0);
+	operations->linker->plan = opts->plan;
+	if (opts->pipeline && !opts->plan) {	// a plan is made in order.
+		operations->pipeline = cfg_getnum(operations->cfg,
+											"pipeline_depth", 64);
+		if (operations->pipeline < 1) {
+			fprintf(stderr, "%s: pipeline_depth must be 1 or more.\n",
+					operations->cfg->path);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (opts->uring) {
+		unsigned entries = cfg_getnum(operations->cfg, "uring_entries",
+										256);
+		operations->urentries = entries;
+		operations->linker->ur = init_uring(entries);
+		if (!operations->linker->ur) {
+			fputs("io_uring is not available, linking without it.\n",
+					stderr);
+		}
+	}
 	return operations;
 } // init_operations()
 
-char
-**getfromfile(oper_t *ops)
-{ /* Read the given file and generate the list of dirs from it. */
-	mdata *mydat = readfile(ops->filname, 1, 0);
-	size_t count = memlinestostr(mydat);
-	char **list = xmalloc((count+1) * sizeof(char *));
-	list[count] = (char *)NULL;
-	char *cp = mydat->fro;
-	size_t i;
-	for (i = 0; i < count; i++) {
-		if (cp[0] == '/') { // absolute path specified.
-			list[i] = xstrdup(cp);
-		} else {
-			char line[PATH_MAX];
-		/* dirs named in file must be relative to named source dir. */
-			strcpy(line, ops->dirname);
-			strjoin(line, '/', cp, PATH_MAX);
-			list[i] = xstrdup(line);
+static void
+settargets(oper_t *ops, options_t *opts)
+{ /* Set the cloud targets from -c, a comma separated list of
+   * name[:dotdir], each under the source dir. Without its own dotdir a
+   * target gets the -f dir, else Dotty. The default target is
+   * Nextcloud.
+*/
+	char *spec = (opts->cloud_target) ? opts->cloud_target : "Nextcloud";
+	char *dflt = (opts->dot_files_dir) ? opts->dot_files_dir : "Dotty";
+	char *list = xstrdup(spec);
+	char *rest = list, *tok;
+	while ((tok = strsep(&rest, ","))) {	// keeps empty names to reject.
+		char *dot = strchr(tok, ':');
+		if (dot) *dot++ = 0;
+		if (!*tok || (dot && !*dot)) {
+			fprintf(stderr, "Bad cloud target: %s\n", spec);
+			exit(EXIT_FAILURE);
+		}
+		if (ops->ntargets == LK_MAXTARGETS) {
+			fprintf(stderr, "No more than %d cloud targets.\n",
+					LK_MAXTARGETS);
+			exit(EXIT_FAILURE);
 		}
-		if (!exists_dir(list[i])) {
-			fprintf(stderr, "No such dir: %s\n", list[i]);
+		char *target = build_path(ops->dirname, tok, NULL);
+		if (istarget(target, ops)) {
+			fprintf(stderr, "Cloud target given twice: %s\n", tok);
 			exit(EXIT_FAILURE);
 		}
-		cp += strlen(cp) + 1;
+		ops->cloud_targets[ops->ntargets] = target;
+		ops->dotdirs_dirs[ops->ntargets] =
+				build_path(target, (dot) ? dot : dflt, NULL);
+		ops->ntargets++;
 	}
-	free(mydat->fro);
-	return list;
-} // getfromfile()
+	if (!ops->ntargets) {
+		fprintf(stderr, "Bad cloud target: %s\n", spec);
+		exit(EXIT_FAILURE);
+	}
+	free(list);
+	free(opts->cloud_target);	// on the heap from options proc.
+	free(opts->dot_files_dir);
+} // settargets()
 
-void
-processlist(char **synclist, oper_t *ops, int dotsornot)
-{ /* From the list of absolute paths in synclist, sync to the cloud
-   * target.
+static void
+startjournal(oper_t *ops, int resume)
+{ /* Journal the run so that it can be resumed if killed. If resume is
+   * set, go on from the journal of a killed run of the same source dir,
+   * targets and list, repairing the targets of the dirs it was linking.
 */
-	size_t i;
-	size_t hlen = ops->len2target;
-	for (i = 0; synclist[i]; i++) {
-		char buf[PATH_MAX];
-		char command[PATH_MAX];
-		strcpy(buf, synclist[i]);
-		buf[hlen] = 0;
-		strcpy(buf, ops->cloud_target);
-		if (dotsornot) {
-			strcpy(buf, ops->dotdirs_dir);
-			if (!exists_dir(buf)) {
-				int res = mkdir(buf, 0775);
-				if (res) {
-					perror(buf);
-					exit(EXIT_FAILURE);
-				}
-			}
-		}
-		// For every $HOME/somedir, create $HOME/Nextcloud/somedir
-		char wrk[PATH_MAX];
-		strcpy(wrk, synclist[i]);
-		char *cp = &wrk[hlen+1];
-		strjoin(buf, '/', cp, PATH_MAX);
-		if (!exists_dir(buf)) {
-			int res = mkdir(buf, 0775);
-			if (res) {
-				perror(buf);
-				exit(EXIT_FAILURE);
+	char *header[LK_MAXTARGETS + 3];
+	char buf[LK_MAXTARGETS + 2][PATH_MAX + 2];
+	size_t n = 0, k;
+	snprintf(buf[n], PATH_MAX + 2, "S %s", ops->dirname);
+	header[n] = buf[n];
+	n++;
+	for (k = 0; k < ops->ntargets; k++) {
+		snprintf(buf[n], PATH_MAX + 2, "T %s", ops->cloud_targets[k]);
+		header[n] = buf[n];
+		n++;
+	}
+	if (ops->filname) {
+		snprintf(buf[n], PATH_MAX + 2, "L %s", ops->filname);
+		header[n] = buf[n];
+		n++;
+	}
+	header[n] = NULL;
+	size_t batch = cfg_getnum(ops->cfg, "journal_batch", 256);
+	ops->jn = open_journal("csmanager", header, ops->mf, resume, batch);
+	ops->linker->skipino = getinode(ops->jn->fn);	// not into the cloud.
+	if (!ops->jn->resumed) return;
+	size_t ndone = ops->jn->done->count, nrepair;
+	for (nrepair = 0; ops->jn->inflight[nrepair]; nrepair++) ;
+	printf("Resuming: %lu dirs done, %lu to repair.\n", ndone, nrepair);
+	resumerepair(ops);
+} // startjournal()
+
+static void
+dowatch(oper_t *ops, char **synclist, char **dotlist, excl_t *excl)
+{ /* Watch the dirs that have just been linked and link changes to them
+   * as they happen. When working from the source dir rather than a
+   * list, new top level dirs are picked up too.
+*/
+	rd_data *rd = init_recursedir(excl, 1024 * 1024, DT_DIR, 0);
+	rd->nthreads = ops->nthreads;
+	wt_data *wt = init_watch(ops->linker, rd);
+	wt->cfg = ops->cfg;
+	wt->fixthreads = ops->fixthreads;
+	if (!ops->filname) {
+		wt_root(wt, ops->dirname, ops->cloud_targets,
+				(dotlist) ? ops->dotdirs_dirs : NULL);
+	}
+	char **lists[2] = { synclist, dotlist };
+	int dotsornot;
+	for (dotsornot = 0; dotsornot < 2; dotsornot++) {
+		char **list = lists[dotsornot];
+		if (!list) continue;
+		size_t i;
+		for (i = 0; list[i]; i++) {
+			if (istarget(list[i], ops)) continue;
+			char bufs[LK_MAXTARGETS][PATH_MAX];
+			char *dsts[LK_MAXTARGETS];
+			size_t k;
+			for (k = 0; k < ops->ntargets; k++) {
+				dsts[k] = bufs[k];
+				mirrorpath(bufs[k], list[i], ops, dotsornot, k);
 			}
+			wt_addtree(wt, list[i], dsts);
 		}
-		strcpy(command, "/usr/local/bin/synclink -v");
-		strjoin(command, ' ', synclist[i], PATH_MAX);
-		strjoin(command, ' ', buf, PATH_MAX);
-		printf("%s\n", command);
-		xsystem(command, 0);
 	}
-} // processlist()
+	ops->linker->verbose = 1;
+	printf("Watching %s for changes.\n", ops->dirname);
+	fflush(stdout);
+	wt_run(wt);
+	free_watch(wt);
+} // dowatch()
 
-char
-*build_path(char *s1, char *s2, char *s3)
-{ /* Assemble a path of names separated by '/', s3 may be NULL. */
-	char buf[PATH_MAX];
-	strcpy(buf, s1);
-	strjoin(buf, '/', s2, PATH_MAX);
-	if (s3) {
-		strjoin(buf, '/', s3, PATH_MAX);
-	}
-	return xstrdup(buf);
-} // build_path()
@@ -0,0 +1,470 @@
+/*    csmicro.c
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of csmicro is to time the str.c and files.c primitives
+ * that every run goes through, over inputs from a few bytes to hundreds
+ * of MB, so that a change to one of them can be measured before and
+ * after. Each timing is warmed up first, then repeated, and the median
+ * and best of the repeats are reported. Run by 'make micro'.
+ * */
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <errno.h>
+#include "str.h"
+#include "files.h"
+
+typedef struct mc_opts {
+	size_t maxsize;		// largest input, bytes.
+	int reps;			// timed repeats of each size.
+	int warmup;			// untimed runs first.
+	double mintime;		// seconds each repeat must last at least.
+	char *only;			// run just this benchmark, NULL for all.
+	char *tmpdir;		// readfile() input goes here.
+	char *out;			// JSON goes here as well, NULL for none.
+} mc_opts;
+
+typedef struct mc_ctx {	// the input of one benchmark at one size.
+	size_t size;
+	mdata *md;
+	char *buf, *src;
+	char **list;
+	char path[PATH_MAX];
+	int made;			// path is a file the setup wrote.
+} mc_ctx;
+
+typedef struct mc_bench {
+	const char *name;
+	size_t cap;			// largest size the function accepts, 0 for none.
+	void (*setup)(mc_ctx *);
+	void (*op)(mc_ctx *);	// one op processes size bytes of input.
+	void (*teardown)(mc_ctx *);
+} mc_bench;
+
+static const char *pathline = "/home/user/Documents/projects/file.txt";
+
+static void
+microopts(int argc, char **argv, mc_opts *o);
+static void
+microhelp(int forced);
+static size_t
+getsize(const char *s);
+static double
+now(void);
+static double
+timeop(const mc_bench *b, mc_ctx *c, size_t iters);
+static int
+dblcmp(const void *a, const void *b);
+static mdata
+*textblock(size_t size);
+static void
+su_none(mc_ctx *c);
+static void
+su_block(mc_ctx *c);
+static void
+su_strjoin(mc_ctx *c);
+static void
+su_list2array(mc_ctx *c);
+static void
+su_trimspace(mc_ctx *c);
+static void
+su_instrlist(mc_ctx *c);
+static void
+su_readfile(mc_ctx *c);
+static void
+op_meminsert(mc_ctx *c);
+static void
+op_memresize(mc_ctx *c);
+static void
+op_memreplace(mc_ctx *c);
+static void
+op_memlinestostr(mc_ctx *c);
+static void
+op_strjoin(mc_ctx *c);
+static void
+op_list2array(mc_ctx *c);
+static void
+op_trimspace(mc_ctx *c);
+static void
+op_instrlist(mc_ctx *c);
+static void
+op_readfile(mc_ctx *c);
+static void
+td_all(mc_ctx *c);
+
+/* list2array() and trimspace() copy through PATH_MAX buffers, strjoin()
+ * is only ever given one, so they are capped there. */
+static const mc_bench benches[] = {
+	{ "meminsert", 0, su_none, op_meminsert, td_all },
+	{ "memresize", 0, su_block, op_memresize, td_all },
+	{ "memreplace", 0, su_block, op_memreplace, td_all },
+	{ "memlinestostr", 0, su_block, op_memlinestostr, td_all },
+	{ "strjoin", PATH_MAX - 1, su_strjoin, op_strjoin, td_all },
+	{ "list2array", PATH_MAX - 1, su_list2array, op_list2array, td_all },
+	{ "trimspace", PATH_MAX - 1, su_trimspace, op_trimspace, td_all },
+	{ "instrlist", 0, su_instrlist, op_instrlist, td_all },
+	{ "readfile", 0, su_readfile, op_readfile, td_all },
+};
+
+int main(int argc, char **argv)
+{
+	mc_opts o;
+	microopts(argc, argv, &o);
+	FILE *fpo = (o.out) ? dofopen(o.out, "w") : NULL;
+	if (fpo) fputs("[\n", fpo);
+	printf("%-14s %12s %10s %14s %14s %12s\n", "function", "bytes",
+			"ops", "ns/op median", "ns/op best", "MB/s");
+	double *times = xmalloc(o.reps * sizeof(double));
+	int first = 1;
+	size_t i;
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		const mc_bench *b = &benches[i];
+		if (o.only && strcmp(o.only, b->name) != 0) continue;
+		size_t size;
+		for (size = 16; size <= o.maxsize; size *= 16) {
+			if (b->cap && size > b->cap) size = b->cap;
+			mc_ctx c;
+			memset(&c, 0, sizeof(mc_ctx));
+			c.size = size;
+			strcpy(c.path, o.tmpdir);
+			b->setup(&c);
+			int w;
+			double t1 = 0;
+			for (w = 0; w < o.warmup; w++) t1 = timeop(b, &c, 1);
+			if (!o.warmup) t1 = timeop(b, &c, 1);
+			size_t iters = (t1 > 0) ? o.mintime / t1 + 1 : 1000000;
+			int r;
+			for (r = 0; r < o.reps; r++) {
+				times[r] = timeop(b, &c, iters) / iters;
+			}
+			b->teardown(&c);
+			qsort(times, o.reps, sizeof(double), dblcmp);
+			double med = times[o.reps / 2];
+			double best = times[0];
+			double mbs = size / med / 1e6;
+			printf("%-14s %12lu %10lu %14.1f %14.1f %12.1f\n", b->name,
+					size, iters, med * 1e9, best * 1e9, mbs);
+			fflush(stdout);
+			if (fpo) {
+				fprintf(fpo, "%s  {\"function\": \"%s\", \"bytes\": %lu, "
+					"\"ops\": %lu, \"reps\": %d, \"ns_per_op\": %.1f, "
+					"\"ns_per_op_best\": %.1f, \"bytes_per_s\": %.0f}",
+					(first) ? "" : ",\n", b->name, size, iters, o.reps,
+					med * 1e9, best * 1e9, size / med);
+				first = 0;
+			}
+			if (b->cap && size == b->cap) break;
+		}
+	}
+	if (fpo) {
+		fputs("\n]\n", fpo);
+		dofclose(fpo);
+	}
+	free(times);
+	return 0;
+} // main()
+
+static void
+microopts(int argc, char **argv, mc_opts *o)
+{ /* Defaults, then the command line. */
+	memset(o, 0, sizeof(mc_opts));
+	o->maxsize = 256 * 1024 * 1024;
+	o->reps = 5;
+	o->warmup = 1;
+	o->mintime = 0.05;
+	o->tmpdir = "/tmp";
+	int c;
+	while ((c = getopt(argc, argv, ":hm:r:w:t:b:d:o:")) != -1) {
+		switch (c) {
+		case 'h':
+			microhelp(0);
+			break;
+		case 'm':
+			o->maxsize = getsize(optarg);
+			break;
+		case 'r':
+			o->reps = strtol(optarg, NULL, 10);
+			break;
+		case 'w':
+			o->warmup = strtol(optarg, NULL, 10);
+			break;
+		case 't':
+			o->mintime = strtod(optarg, NULL) / 1000;
+			break;
+		case 'b':
+			o->only = optarg;
+			break;
+		case 'd':
+			o->tmpdir = optarg;
+			break;
+		case 'o':
+			o->out = optarg;
+			break;
+		case ':':
+			fprintf(stderr, "Option -%c requires an argument\n", optopt);
+			microhelp(1);
+			break;
+		default:
+			fprintf(stderr, "Unknown option: -%c\n", optopt);
+			microhelp(1);
+			break;
+		}
+	}
+	if (o->reps < 1 || o->warmup < 0 || o->mintime < 0
+		|| o->maxsize < 16) microhelp(1);
+} // microopts()
+
+static void
+microhelp(int forced)
+{ /* Usage, exits. */
+	fputs("Usage: csmicro [-m maxsize] [-r reps] [-w warmup] [-t ms]"
+		" [-b function]\n\t[-d tmpdir] [-o out.json]\n"
+		"Times meminsert, memresize, memreplace, memlinestostr, strjoin,"
+		"\nlist2array, trimspace, instrlist and readfile on inputs of 16 "
+		"bytes\nup to maxsize, default 256M, in steps of 16 times. Sizes "
+		"may end in\nK, M or G. Each size is run warmup times, default 1, "
+		"then timed\nreps times, default 5, each repeat lasting at least "
+		"ms, default 50.\nThe memreplace op is a replacement and its "
+		"reverse, memlinestostr\nis followed by memstrtolines.\n",
+		(forced) ? stderr : stdout);
+	exit(forced ? EXIT_FAILURE : EXIT_SUCCESS);
+} // microhelp()
+
+static size_t
+getsize(const char *s)
+{ /* Number of bytes, with an optional K, M or G suffix. */
+	char *end;
+	size_t n = strtoul(s, &end, 10);
+	switch (*end) {
+	case 'G': case 'g':
+		n *= 1024;
+		/* fall through */
+	case 'M': case 'm':
+		n *= 1024;
+		/* fall through */
+	case 'K': case 'k':
+		n *= 1024;
+		break;
+	}
+	return n;
+} // getsize()
+
+static double
+now(void)
+{ /* Monotonic time in seconds. */
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+} // now()
+
+static double
+timeop(const mc_bench *b, mc_ctx *c, size_t iters)
+{ /* Seconds taken to do iters ops. */
+	double t = now();
+	size_t i;
+	for (i = 0; i < iters; i++) b->op(c);
+	return now() - t;
+} // timeop()
+
+static int
+dblcmp(const void *a, const void *b)
+{ /* qsort() comparison of doubles. */
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+} // dblcmp()
+
+static mdata
+*textblock(size_t size)
+{ /* A block of size bytes of path names, one per line. */
+	mdata *md = init_mdata();
+	md->fro = xmalloc(size + 1);
+	size_t plen = strlen(pathline);
+	size_t i;
+	for (i = 0; i < size; i += plen + 1) {
+		size_t n = (size - i > plen) ? plen : size - i;
+		memcpy(md->fro + i, pathline, n);
+		if (i + n < size) md->fro[i + n] = '\n';
+	}
+	md->fro[size] = 0;
+	md->to = md->limit = md->fro + size;
+	return md;
+} // textblock()
+
+static void
+su_none(mc_ctx *c)
+{
+	(void)c;
+} // su_none()
+
+static void
+su_block(mc_ctx *c)
+{ /* Lines of text. */
+	c->md = textblock(c->size);
+} // su_block()
+
+static void
+su_strjoin(mc_ctx *c)
+{ /* Two halves to be joined by '/' into a buffer just big enough. */
+	size_t half = c->size / 2;
+	c->buf = xmalloc(c->size + 2);
+	memset(c->buf, 'a', half);
+	c->buf[half] = 0;
+	c->src = xmalloc(c->size - half + 1);
+	memset(c->src, 'b', c->size - half);
+	c->src[c->size - half] = 0;
+} // su_strjoin()
+
+static void
+su_list2array(mc_ctx *c)
+{ /* A comma separated list with spaces after the commas. */
+	c->src = xmalloc(c->size + 1);
+	const char *item = "word, ";
+	size_t i;
+	for (i = 0; i < c->size; i++) c->src[i] = item[i % 6];
+	c->src[c->size] = 0;
+} // su_list2array()
+
+static void
+su_trimspace(mc_ctx *c)
+{ /* Text with white space at both ends, and a buffer to trim it in. */
+	c->src = xmalloc(c->size + 1);
+	memset(c->src, 'x', c->size);
+	size_t n = (c->size < 8) ? c->size / 2 : 4;
+	memset(c->src, ' ', n);
+	memset(c->src + c->size - n, '\t', n);
+	c->src[c->size] = 0;
+	c->buf = xmalloc(c->size + 1);
+} // su_trimspace()
+
+static void
+su_instrlist(mc_ctx *c)
+{ /* A list of path names, the one sought is last. */
+	size_t plen = strlen(pathline);
+	size_t count = c->size / (plen + 1);
+	if (!count) count = 1;
+	c->list = xmalloc((count + 1) * sizeof(char *));
+	size_t i;
+	for (i = 0; i < count; i++) {
+		char buf[PATH_MAX];
+		sprintf(buf, "%s.%lu", pathline, i);
+		c->list[i] = xstrdup(buf);
+	}
+	c->list[count] = NULL;
+	c->src = xstrdup(c->list[count - 1]);
+} // su_instrlist()
+
+static void
+su_readfile(mc_ctx *c)
+{ /* A file of text in the tmp dir. */
+	char name[NAME_MAX];
+	sprintf(name, "csmicro.%ld", (long)getpid());
+	strjoin(c->path, '/', name, PATH_MAX);
+	mdata *md = textblock(c->size);
+	writefile(c->path, md->fro, md->to, "w");
+	c->made = 1;
+	free_mdata(md);
+} // su_readfile()
+
+static void
+op_meminsert(mc_ctx *c)
+{ /* Build a block of size bytes a line at a time. */
+	mdata *md = init_mdata();
+	size_t len = 0;
+	size_t plen = strlen(pathline) + 1;
+	while (len < c->size) {
+		meminsert(pathline, md, 1024);
+		len += plen;
+	}
+	free_mdata(md);
+} // op_meminsert()
+
+static void
+op_memresize(mc_ctx *c)
+{ /* Double the block then shrink it back. */
+	memresize(c->md, c->size);
+	memresize(c->md, -(off_t)c->size);
+} // op_memresize()
+
+static void
+op_memreplace(mc_ctx *c)
+{ /* A longer replacement, then back again. */
+	memreplace(c->md, "user", "someone", 0);
+	memreplace(c->md, "someone", "user", 0);
+} // op_memreplace()
+
+static void
+op_memlinestostr(mc_ctx *c)
+{ /* Split into strings, then back into lines. */
+	memlinestostr(c->md);
+	memstrtolines(c->md);
+} // op_memlinestostr()
+
+static void
+op_strjoin(mc_ctx *c)
+{
+	c->buf[c->size / 2] = 0;
+	strjoin(c->buf, '/', c->src, c->size + 2);
+} // op_strjoin()
+
+static void
+op_list2array(mc_ctx *c)
+{
+	char **list = list2array(c->src, ',');
+	destroystrarray(list, 0);
+} // op_list2array()
+
+static void
+op_trimspace(mc_ctx *c)
+{
+	memcpy(c->buf, c->src, c->size + 1);
+	trimspace(c->buf);
+} // op_trimspace()
+
+static void
+op_instrlist(mc_ctx *c)
+{
+	if (!instrlist(c->src, c->list)) abort();
+} // op_instrlist()
+
+static void
+op_readfile(mc_ctx *c)
+{
+	mdata *md = readfile(c->path, 1, 0);
+	free_mdata(md);
+} // op_readfile()
+
+static void
+td_all(mc_ctx *c)
+{ /* Free whatever the setup made, remove any file it wrote. */
+	if (c->md) free_mdata(c->md);
+	free(c->buf);
+	free(c->src);
+	if (c->list) destroystrarray(c->list, 0);
+	if (c->made && unlink(c->path) == -1) perror(c->path);
+} // td_all()
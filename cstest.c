@@ -0,0 +1,310 @@
+/*    cstest.c
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of cstest is to check the str.c primitives that have fast
+ * paths against plain versions of themselves. Each vector kernel of
+ * memswap() is called directly, so every one this CPU can run is tested
+ * and not only the one memswap() would pick, over lengths from 0 to
+ * several vector widths and every start alignment within 64 bytes.
+ * memreplace() is checked on the boundary cases its comments have been
+ * about, then on random input against a naive copy. Run by 'make check',
+ * it exits non zero if anything differs.
+ * */
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+/* The kernels are static, so str.c is built into this program rather
+ * than linked. */
+#include "str.c"
+
+typedef struct ct_kernel {
+	const char *name;
+	const char *cpu;	// feature it needs, NULL if none.
+	swapfn fn;
+} ct_kernel;
+
+static uint64_t rng = 0x9E3779B97F4A7C15ULL;
+static size_t nfails;
+
+static uint64_t
+nextrand(void);
+static void
+fail(const char *test, const char *fmt, ...);
+static void
+testswap(const ct_kernel *k);
+static void
+testdispatch(void);
+static char
+*refreplace(const char *text, size_t len, const char *find,
+				const char *repl, size_t *newlen);
+static void
+checkreplace(const char *test, const char *text, size_t len, size_t spare,
+				const char *find, const char *repl, off_t meminc);
+static void
+testreplace(void);
+
+static const ct_kernel kernels[] = {
+#ifdef __SSE2__
+	{ "swap_sse2", NULL, swap_sse2 },
+	{ "swap_avx2", "avx2", swap_avx2 },
+	{ "swap_avx512", "avx512bw", swap_avx512 },
+#endif
+	{ "swap_scalar", NULL, swap_scalar },	// itself, for the guards.
+};
+
+int main(int argc, char **argv)
+{
+	if (argc > 1) rng = strtoull(argv[1], NULL, 10) * 2 + 1;	// a seed.
+#ifdef __SSE2__
+	__builtin_cpu_init();
+#endif
+	size_t i;
+	for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+		const ct_kernel *k = &kernels[i];
+#ifdef __SSE2__
+		/* __builtin_cpu_supports() wants a literal, hence the names. */
+		int have = !k->cpu
+				|| (strcmp(k->cpu, "avx2") == 0
+					&& __builtin_cpu_supports("avx2"))
+				|| (strcmp(k->cpu, "avx512bw") == 0
+					&& __builtin_cpu_supports("avx512bw"));
+#else
+		int have = !k->cpu;
+#endif
+		if (!have) {
+			printf("SKIP %s, this CPU lacks %s\n", k->name, k->cpu);
+			continue;
+		}
+		testswap(k);
+	}
+	testdispatch();
+	testreplace();
+	if (nfails) {
+		printf("FAIL %lu checks\n", nfails);
+		return EXIT_FAILURE;
+	}
+	puts("PASS");
+	return 0;
+} // main()
+
+static uint64_t
+nextrand(void)
+{ /* xorshift64*, the same run every time for a given seed. */
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return rng * 0x2545F4914F6CDD1DULL;
+} // nextrand()
+
+static void
+fail(const char *test, const char *fmt, ...)
+{ /* Report one failed check, the first few of each test in full. */
+	nfails++;
+	if (nfails > 20) return;
+	printf("FAIL %s: ", test);
+	va_list ap;
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	putchar('\n');
+} // fail()
+
+static void
+testswap(const ct_kernel *k)
+{ /* Run kernel k and swap_scalar() over the same random bytes for every
+   * length up to 4 AVX-512 widths and a bit, at each start offset in a
+   * 64 byte aligned buffer, and compare the counts and the bytes. The
+   * 64 bytes either side of the range must be left alone. Find and repl
+   * are sometimes the same, when only counting is done.
+*/
+	enum { MAXLEN = 4 * 64 + 17, GUARD = 64 };
+	// aligned_alloc() wants a multiple of the alignment.
+	size_t bufsize = (GUARD + 64 + MAXLEN + GUARD + 63) & ~(size_t)63;
+	unsigned char *want = aligned_alloc(64, bufsize);
+	unsigned char *got = aligned_alloc(64, bufsize);
+	if (!want || !got) {
+		fputs("Out of memory.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	size_t before = nfails;
+	size_t len, off, i;
+	for (len = 0; len <= MAXLEN; len++) {
+		for (off = 0; off < 64; off++) {
+			char find = nextrand() % 4;	// 0 and '\n' are the usual.
+			if (find == 3) find = '\n';
+			char repl = (nextrand() % 8) ? (char)(nextrand() % 256) : find;
+			int density = 1 + nextrand() % 8;	// 1 in density are find.
+			for (i = 0; i < bufsize; i++) {
+				want[i] = (nextrand() % density == 0) ? find
+							: (unsigned char)nextrand();
+			}
+			memcpy(got, want, bufsize);
+			size_t start = GUARD + off;
+			size_t nwant = swap_scalar((char *)want + start,
+							(char *)want + start + len, find, repl);
+			size_t ngot = k->fn((char *)got + start,
+							(char *)got + start + len, find, repl);
+			if (nwant != ngot) {
+				fail(k->name, "len %lu offset %lu: count %lu, want %lu",
+						len, off, ngot, nwant);
+			}
+			if (memcmp(want, got, bufsize) != 0) {
+				for (i = 0; want[i] == got[i]; i++) ;
+				fail(k->name, "len %lu offset %lu: byte %ld differs",
+						len, off, (long)i - (long)start);
+			}
+		}
+	}
+	free(want);
+	free(got);
+	if (nfails == before) printf("PASS %s\n", k->name);
+} // testswap()
+
+static void
+testdispatch(void)
+{ /* The kernel memswap() picks, through the public functions. */
+	mdata md;
+	char text[] = "one\ntwo\n\nthree\nfour five six seven eight nine ten "
+				"eleven twelve\nthirteen fourteen fifteen sixteen\n";
+	size_t len = strlen(text);
+	md.fro = text;
+	md.to = text + len;
+	md.limit = md.to;
+	size_t before = nfails;
+	size_t n = memlinestostr(&md);
+	if (n != 6) fail("memlinestostr", "%lu lines, want 6", n);
+	n = countmemstr(&md);
+	if (n != 6) fail("countmemstr", "%lu strings, want 6", n);
+	n = memstrtolines(&md);
+	if (n != 6 || strlen(text) != len)
+		fail("memstrtolines", "%lu lines, want 6", n);
+	md.to = md.fro;	// empty.
+	if (memlinestostr(&md)) fail("memlinestostr", "empty block");
+	if (nfails == before) puts("PASS memswap dispatch");
+} // testdispatch()
+
+static char
+*refreplace(const char *text, size_t len, const char *find,
+				const char *repl, size_t *newlen)
+{ /* The result memreplace() should give, worked out the slow way: left
+   * to right, matches never overlap and repl is never searched.
+*/
+	size_t flen = strlen(find), rlen = strlen(repl);
+	char *out = xmalloc(len * (rlen + 1) + 1);
+	size_t i = 0, o = 0;
+	while (i < len) {
+		if (flen && i + flen <= len && memcmp(text + i, find, flen) == 0) {
+			memcpy(out + o, repl, rlen);
+			o += rlen;
+			i += flen;
+		} else {
+			out[o++] = text[i++];
+		}
+	}
+	*newlen = o;
+	return out;
+} // refreplace()
+
+static void
+checkreplace(const char *test, const char *text, size_t len, size_t spare,
+				const char *find, const char *repl, off_t meminc)
+{ /* Put text in a block with spare bytes after it, run memreplace() on
+   * it and check the result against refreplace(). A block that grew
+   * must have meminc zeroed bytes spare, one that did not must keep its
+   * limit.
+*/
+	mdata md;
+	md.fro = xmalloc(len + spare + 1);
+	memcpy(md.fro, text, len);
+	memset(md.fro + len, 'Z', spare + 1);	// must not show up.
+	md.to = md.fro + len;
+	md.limit = md.to + spare;
+	char *oldfro = md.fro, *oldlimit = md.limit;
+	size_t wantlen;
+	char *want = refreplace(text, len, find, repl, &wantlen);
+	memreplace(&md, (char *)find, (char *)repl, meminc);
+	size_t gotlen = md.to - md.fro;
+	if (gotlen != wantlen || memcmp(md.fro, want, wantlen) != 0) {
+		fail(test, "'%.*s' -> '%.*s', want '%.*s'", (int)len, text,
+				(int)gotlen, md.fro, (int)wantlen, want);
+	} else if (md.fro == oldfro) {	// in place.
+		if (md.limit != oldlimit) fail(test, "limit moved in place");
+	} else {
+		size_t i, left = md.limit - md.to;
+		if (left != (size_t)((meminc > 0) ? meminc : 0))
+			fail(test, "%lu bytes spare, want %ld", left, (long)meminc);
+		for (i = 0; i < left; i++) {
+			if (md.to[i]) {
+				fail(test, "spare byte %lu is not 0", i);
+				break;
+			}
+		}
+	}
+	free(want);
+	free(md.fro);
+} // checkreplace()
+
+static void
+testreplace(void)
+{ /* The boundary cases, then random ones. */
+	size_t before = nfails;
+	// Growth of 1 per match, with the block's spare room exactly what is
+	// needed, then 1 and 2 bytes more. The old version went wrong here.
+	checkreplace("exact fit", "a.b.c", 5, 2, ".", "..", 0);
+	checkreplace("1 spare", "a.b.c", 5, 3, ".", "..", 0);
+	checkreplace("2 spare", "a.b.c", 5, 4, ".", "..", 0);
+	checkreplace("no spare", "a.b.c", 5, 0, ".", "..", 0);
+	checkreplace("exact fit meminc", "a.b.c", 5, 2, ".", "..", 2);
+	checkreplace("grow", "x/y/z", 5, 0, "/", "<sep>", 64);	// memset.
+	checkreplace("grow at ends", "/x/", 3, 0, "/", "//", 16);
+	checkreplace("shrink", "aXXbXXcXX", 9, 0, "XX", "Y", 0);
+	checkreplace("shrink to empty", "XXXX", 4, 0, "XX", "", 0);
+	checkreplace("equal length", "cat hat cat", 11, 0, "cat", "dog", 0);
+	checkreplace("no match", "abcdef", 6, 3, "xyz", "longer", 8);
+	checkreplace("no match shrink", "abcdef", 6, 0, "xyz", "q", 0);
+	checkreplace("empty find", "abc", 3, 0, "", "x", 0);
+	checkreplace("empty block", "", 0, 0, "a", "bb", 4);
+	checkreplace("adjacent", "aaaa", 4, 0, "aa", "b", 0);
+	checkreplace("adjacent grow", "aaaaa", 5, 0, "aa", "xyz", 0);
+	checkreplace("overlapping", "aaa", 3, 0, "aa", "b", 0);
+	checkreplace("repl has find", "a-a-a", 5, 0, "a", "aa", 0);
+	checkreplace("repl has find twice", "ab", 2, 0, "ab", "abab", 4);
+	checkreplace("whole block", "find", 4, 0, "find", "replace", 0);
+	if (nfails == before) puts("PASS memreplace cases");
+	before = nfails;
+	char text[200], find[4], repl[8];
+	int t;
+	for (t = 0; t < 20000; t++) {
+		size_t len = nextrand() % sizeof(text), i;
+		for (i = 0; i < len; i++) text[i] = 'a' + nextrand() % 3;
+		size_t flen = 1 + nextrand() % 3, rlen = nextrand() % 8;
+		for (i = 0; i < flen; i++) find[i] = 'a' + nextrand() % 3;
+		find[flen] = 0;
+		for (i = 0; i < rlen; i++) repl[i] = 'a' + nextrand() % 4;
+		repl[rlen] = 0;
+		checkreplace("random", text, len, nextrand() % 4, find, repl,
+						nextrand() % 3);
+	}
+	if (nfails == before) puts("PASS memreplace random");
+} // testreplace()
@@ -25,6 +25,65 @@
 
 #include "dirs.h"
 
+typedef struct rd_parent {	// a dir read, kept open for its sub-dirs.
+	int fd;
+	size_t refs;	// sub-dirs not yet opened, and the reader.
+} rd_parent;
+
+typedef struct rd_dir {	// a dir waiting to be read.
+	char *path;
+	rd_parent *parent;	// NULL to open it by path.
+} rd_dir;
+
+typedef struct rd_deque {	// dirs waiting to be read by one thread.
+	pthread_mutex_t lock;
+	rd_dir *dirs;
+	size_t head, tail, size;	// steal from head, push/pop at tail.
+} rd_deque;
+
+struct rd_pool;
+
+typedef struct rd_worker {
+	struct rd_pool *pool;
+	rd_deque dq;
+	sarena *out;	// this thread's output, merged at the end.
+	size_t recs;
+	int id;
+} rd_worker;
+
+typedef struct rd_pool {
+	rd_data *rd;
+	rd_worker *workers;
+	int n;
+	size_t pending;	// dirs queued or being read by any thread.
+	size_t queued;	// dirs in the deques.
+	size_t nparents;	// rd_parents holding an fd.
+	pthread_mutex_t lock;	// for more.
+	pthread_cond_t more;	// a dir was queued, or all are read.
+	int idle;	// threads waiting on more.
+} rd_pool;
+
+static void
+dq_push(rd_deque *dq, rd_dir *d);
+static int
+dq_pop(rd_deque *dq, rd_dir *d);
+static int
+dq_steal(rd_deque *dq, rd_dir *d);
+static void
+*rd_work(void *arg);
+static void
+rd_idle(rd_pool *pool);
+static void
+rd_queue(rd_worker *w, char *path, rd_parent *parent);
+static void
+rd_unref(rd_pool *pool, rd_parent *parent);
+static void
+rd_scan(rd_dir *d, rd_worker *w);
+static void
+rd_reopen(dr_data *dr, const char *path, off_t off);
+static int
+dc_dir(char *path, int *made, int wantfd);
+
 DIR
 *dopendir(const char *name)
 { /* open a dir with error handling */
@@ -37,65 +96,489 @@ DIR
 } // dopendir()
 
 int
-recursedir(char *dirname, mdata *ddat, rd_data *rd)
+recursedir(char *dirname, sarena *ddat, rd_data *rd)
 { /* Returns count of records recorded.
 	* Caller must init_recursedir() before calling this.
+	* Every dir is opened relative to the fd of its parent and one path
+	* buffer is extended and truncated in place as we go. The open dirs
+	* are kept on a stack rather than recursing, so the depth of the
+	* tree costs only a small read buffer per level. No more than
+	* RD_MAXFDS of them hold an fd, those further up are closed on the
+	* way down and reopened by path on the way back, carrying on where
+	* they were. Each buffer is freed as its dir is done.
 	*/
-	DIR *dp = dopendir(dirname);
-	static int recs = 0;
-	struct dirent *de;
-	while ((de = readdir(dp))) {
-		if (strcmp(de->d_name, ".") == 0 ) continue;
-		if (strcmp(de->d_name, "..") == 0) continue;
-		char joinbuf[PATH_MAX];
-		strcpy(joinbuf, dirname);
-		strjoin(joinbuf, '/', de->d_name, PATH_MAX);
-		/* If there is list of paths to reject check that any dirs
-		 * found are not in rd->rejectlist[] */
-		if ((rd->rejectlist) && de->d_type == DT_DIR) {
-			if(instrlist(joinbuf, rd->rejectlist)) continue;
+	typedef struct rd_frame {
+		dr_data dr;
+		size_t plen;	// length of path naming dr.
+		off_t off;	// where to carry on reading once dr is reopened.
+	} rd_frame;
+	char path[PATH_MAX];
+	strcpy(path, dirname);
+	size_t size = 64;
+	rd_frame *stack = xmalloc(size * sizeof(rd_frame));
+	size_t depth = 1;
+	if (dr_open(&stack[0].dr, AT_FDCWD, dirname) == -1) {
+		perror(dirname);
+		exit(EXIT_FAILURE);
+	}
+	stack[0].plen = strlen(path);
+	while (depth) {
+		rd_frame *fr = &stack[depth - 1];
+		path[fr->plen] = 0;
+		if (fr->dr.fd == -1) rd_reopen(&fr->dr, path, fr->off);
+		dr_ent ent;
+		dr_ent *de = dr_read(&fr->dr, &ent);
+		if (!de) {
+			dr_close(&fr->dr);
+			depth--;
+			continue;
 		}
+		int dfd = fr->dr.fd;
+		unsigned char type = de->type;
+		if (type == DT_UNKNOWN) {	// some file systems don't do d_type
+			struct stat sb;
+			st_add(ST_STAT, 1);
+			if (fstatat(dfd, de->name, &sb, AT_SYMLINK_NOFOLLOW) == -1)
+				continue;	// gone since it was read.
+			type = IFTODT(sb.st_mode);
+		}
+		size_t plen = pathjoin(path, fr->plen, de->name);
+		// Dirs excluded by rd->excl are neither listed nor entered.
+		if (type == DT_DIR && excluded(rd->excl, path)) continue;
 		// Output only file system objects named in rd->fsobj[]
-		if (in_uch_array(de->d_type, rd->fsobj)) {
-			meminsert(joinbuf, ddat, rd->meminc);
-			recs++;
+		if (in_uch_array(type, rd->fsobj)) {
+			sa_insert(ddat, path);
+			rd->recs++;
 		}
-		if (de->d_type == DT_DIR) {
-			recursedir(joinbuf, ddat, rd);
+		if (type == DT_DIR) {
+			if (depth == size) {
+				size *= 2;
+				stack = realloc(stack, size * sizeof(rd_frame));
+				if (!stack) {
+					fputs("Out of memory.\n", stderr);
+					exit(EXIT_FAILURE);
+				}
+			}
+			if (dr_open(&stack[depth].dr, dfd, de->name) == -1) {
+				perror(path);
+				exit(EXIT_FAILURE);
+			}
+			stack[depth].plen = plen;
+			depth++;
+			// Keep no more than RD_MAXFDS open, those above may be
+			// closed already.
+			fr = (depth > RD_MAXFDS) ? &stack[depth - 1 - RD_MAXFDS] : NULL;
+			if (fr && fr->dr.fd != -1) {
+				fr->off = lseek(fr->dr.fd, 0, SEEK_CUR);
+				if (fr->off == -1) {
+					perror("lseek");
+					exit(EXIT_FAILURE);
+				}
+				if (close(fr->dr.fd) == -1) {	// the buffer is kept.
+					perror("close");
+					exit(EXIT_FAILURE);
+				}
+				fr->dr.fd = -1;
+			}
 		}
 	} // while()
-	doclosedir(dp);
-	return recs;
+	free(stack);
+	return rd->recs;
 } // recursedir()
 
+static void
+rd_reopen(dr_data *dr, const char *path, off_t off)
+{ /* Open path again for a dr closed by recursedir() to save fds, and
+   * seek to off, the offset it was closed at. Entries already in the
+   * buffer are kept, reading goes on after them.
+*/
+	dr->fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (dr->fd == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	st_add(ST_OPENDIR, 1);
+	if (lseek(dr->fd, off, SEEK_SET) == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+} // rd_reopen()
+
+size_t
+pathjoin(char *path, size_t plen, const char *name)
+{ /* Put '/' and name after the first plen bytes of path, a buffer of
+   * PATH_MAX, and return the new length. Unlike strjoin() the length
+   * of path is not looked for, so the caller can truncate and extend
+   * the one buffer in place as it walks a tree.
+*/
+	size_t nlen = strlen(name);
+	if (plen + nlen + 2 > PATH_MAX) {
+		path[plen] = 0;
+		fprintf(stderr, "Path too long: %s/%s\n", path, name);
+		exit(EXIT_FAILURE);
+	}
+	path[plen] = '/';
+	memcpy(path + plen + 1, name, nlen + 1);
+	return plen + nlen + 1;
+} // pathjoin()
+
+/* The dr_*() functions read dirs with getdents64() into a buffer of
+ * their own. It starts at DR_MINBUF, enough for most dirs in one call,
+ * and doubles each time a read fills it, up to DR_BUFSIZE, so a dir of
+ * hundreds of thousands of entries still takes a handful of system
+ * calls while a deep tree of small dirs costs little memory. The buffer
+ * is freed by dr_close().
+ * */
+
+struct linux_dirent64 {	// as the kernel lays it out.
+	ino64_t d_ino;
+	off64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/* Dirs known to exist, made or found by mkdirp(), each with fd + 2:
+ * an O_PATH fd if children have been made in it with mkdirat(), else
+ * -1, so that leaf dirs, the most of them, hold no fd. */
+static hash_t *dc_known;
+static pthread_mutex_t dc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int
+dr_open(dr_data *dr, int dfd, const char *name)
+{ /* Open name relative to dfd for dr_read(). Symlinks are not followed.
+   * Returns -1 with errno set on failure, otherwise 0.
+*/
+	dr->fd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW
+						| O_CLOEXEC);
+	if (dr->fd == -1) return -1;
+	st_add(ST_OPENDIR, 1);
+	dr->size = DR_MINBUF;
+	dr->buf = xmalloc(dr->size);
+	dr->pos = dr->len = 0;
+	return 0;
+} // dr_open()
+
+dr_ent
+*dr_read(dr_data *dr, dr_ent *ent)
+{ /* Fill in ent with the next entry of dr, other than . and .., and
+   * return it, or NULL at the end. The name is not copied, it stays
+   * valid until the next dr_read() of dr. Errors are fatal.
+*/
+	while (1) {
+		if (dr->pos >= dr->len) {
+			// No room was left for another entry, so there are more.
+			if (dr->size - dr->len < sizeof(struct linux_dirent64)
+				+ NAME_MAX + 1 && dr->size < DR_BUFSIZE) {
+				dr->size *= 2;
+				free(dr->buf);
+				dr->buf = xmalloc(dr->size);
+			}
+			long n = syscall(SYS_getdents64, dr->fd, dr->buf, dr->size);
+			st_add(ST_GETDENTS, 1);
+			if (n == -1) {
+				perror("getdents64");
+				exit(EXIT_FAILURE);
+			}
+			if (n == 0) return NULL;
+			dr->len = n;
+			dr->pos = 0;
+		}
+		struct linux_dirent64 *d =
+				(struct linux_dirent64 *)(dr->buf + dr->pos);
+		dr->pos += d->d_reclen;
+		if (d->d_name[0] == '.' && (d->d_name[1] == 0 ||
+			(d->d_name[1] == '.' && d->d_name[2] == 0))) continue;
+		ent->ino = d->d_ino;
+		ent->type = d->d_type;
+		ent->name = d->d_name;
+		return ent;
+	}
+} // dr_read()
+
+void
+dr_close(dr_data *dr)
+{ /* Close a dir opened by dr_open() and free its buffer. */
+	if (close(dr->fd) == -1) {
+		perror("close");
+		exit(EXIT_FAILURE);
+	}
+	dr->fd = -1;
+	free(dr->buf);
+	dr->buf = NULL;
+} // dr_close()
+
+int
+recursedir_mt(char *dirname, sarena *ddat, rd_data *rd)
+{ /* As for recursedir() but the dirs are read by rd->nthreads worker
+   * threads. Each thread keeps its own deque of dirs waiting to be
+   * read, taking work from its own tail and stealing from the head of
+   * the others when it runs dry. Each thread has its own arena and
+   * these are appended to ddat when all are done, so the order of
+   * records differs from recursedir().
+*/
+	if (rd->nthreads < 2) return recursedir(dirname, ddat, rd);
+	rd_pool pool;
+	pool.rd = rd;
+	pool.n = rd->nthreads;
+	pool.pending = 1;	// dirname itself.
+	pool.queued = pool.nparents = 0;
+	pool.idle = 0;
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.more, NULL);
+	pool.workers = xmalloc(pool.n * sizeof(rd_worker));
+	memset(pool.workers, 0, pool.n * sizeof(rd_worker));
+	int i;
+	for (i = 0; i < pool.n; i++) {
+		rd_worker *w = &pool.workers[i];
+		w->pool = &pool;
+		w->id = i;
+		w->out = init_sarena(rd->meminc);
+		pthread_mutex_init(&w->dq.lock, NULL);
+	}
+	rd_queue(&pool.workers[0], xstrdup(dirname), NULL);
+	pthread_t *tids = xmalloc(pool.n * sizeof(pthread_t));
+	for (i = 0; i < pool.n; i++) {
+		int res = pthread_create(&tids[i], NULL, rd_work,
+									&pool.workers[i]);
+		if (res) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(res));
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < pool.n; i++) pthread_join(tids[i], NULL);
+	for (i = 0; i < pool.n; i++) {	// merge the output.
+		rd_worker *w = &pool.workers[i];
+		sa_append(ddat, w->out);
+		rd->recs += w->recs;
+		free_sarena(w->out);
+		free(w->dq.dirs);
+		pthread_mutex_destroy(&w->dq.lock);
+	}
+	free(tids);
+	free(pool.workers);
+	pthread_cond_destroy(&pool.more);
+	pthread_mutex_destroy(&pool.lock);
+	return rd->recs;
+} // recursedir_mt()
+
+static void
+*rd_work(void *arg)
+{ /* Thread function for recursedir_mt(). Runs until no dir is waiting
+   * or being read by any thread, sleeping while there is nothing to
+   * take but others are still reading.
+*/
+	rd_worker *w = arg;
+	rd_pool *pool = w->pool;
+	while (1) {
+		rd_dir d;
+		int got = dq_pop(&w->dq, &d), i;
+		for (i = 1; !got && i < pool->n; i++) {
+			got = dq_steal(&pool->workers[(w->id + i) % pool->n].dq, &d);
+		}
+		if (!got) {
+			if (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0)
+				break;
+			rd_idle(pool);
+			continue;
+		}
+		__atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+		rd_scan(&d, w);
+		free(d.path);
+		if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+			pthread_mutex_lock(&pool->lock);	// all read, let all go.
+			pthread_cond_broadcast(&pool->more);
+			pthread_mutex_unlock(&pool->lock);
+		}
+	}
+	return NULL;
+} // rd_work()
+
+static void
+rd_idle(rd_pool *pool)
+{ /* Wait until a dir is queued or all are read. Idle is counted before
+   * queued is looked at and rd_queue() counts queued before it looks at
+   * idle, so one or other sees the change and no wakeup is lost.
+*/
+	pthread_mutex_lock(&pool->lock);
+	__atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0 &&
+			__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) != 0) {
+		pthread_cond_wait(&pool->more, &pool->lock);
+	}
+	__atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&pool->lock);
+} // rd_idle()
+
+static void
+rd_queue(rd_worker *w, char *path, rd_parent *parent)
+{ /* Put the dir path, a sub-dir of parent if that is not NULL, on the
+   * deque of w and wake a thread if any are idle.
+*/
+	rd_pool *pool = w->pool;
+	rd_dir d;
+	d.path = path;
+	d.parent = parent;
+	dq_push(&w->dq, &d);
+	__atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_signal(&pool->more);
+		pthread_mutex_unlock(&pool->lock);
+	}
+} // rd_queue()
+
+static void
+rd_unref(rd_pool *pool, rd_parent *parent)
+{ /* One less use of parent, closed and freed after the last. */
+	if (!parent) return;
+	if (__atomic_sub_fetch(&parent->refs, 1, __ATOMIC_ACQ_REL)) return;
+	if (close(parent->fd) == -1) {
+		perror("close");
+		exit(EXIT_FAILURE);
+	}
+	free(parent);
+	__atomic_sub_fetch(&pool->nparents, 1, __ATOMIC_RELAXED);
+} // rd_unref()
+
+static void
+rd_scan(rd_dir *d, rd_worker *w)
+{ /* Read one dir for recursedir_mt(), sub-dirs are queued on this
+   * thread's deque rather than recursed into. The dir is opened in its
+   * parent's fd, and its own fd is kept for its sub-dirs while there
+   * are fewer than RD_MAXFDS per thread kept so, otherwise they are
+   * opened by path.
+*/
+	rd_pool *pool = w->pool;
+	rd_data *rd = pool->rd;
+	dr_data dr;
+	int pfd = (d->parent) ? d->parent->fd : AT_FDCWD;
+	const char *name = (d->parent) ? strrchr(d->path, '/') + 1 : d->path;
+	if (dr_open(&dr, pfd, name) == -1) {
+		perror(d->path);
+		exit(EXIT_FAILURE);
+	}
+	rd_unref(pool, d->parent);
+	rd_parent *self = NULL;	// made at the first sub-dir.
+	int keep = 1;
+	char joinbuf[PATH_MAX];
+	strcpy(joinbuf, d->path);
+	size_t dlen = strlen(joinbuf);
+	dr_ent ent, *de;
+	while ((de = dr_read(&dr, &ent))) {
+		unsigned char type = de->type;
+		if (type == DT_UNKNOWN) {
+			struct stat sb;
+			st_add(ST_STAT, 1);
+			if (fstatat(dr.fd, de->name, &sb, AT_SYMLINK_NOFOLLOW) == -1)
+				continue;
+			type = IFTODT(sb.st_mode);
+		}
+		pathjoin(joinbuf, dlen, de->name);
+		if (type == DT_DIR && excluded(rd->excl, joinbuf)) continue;
+		if (in_uch_array(type, rd->fsobj)) {
+			sa_insert(w->out, joinbuf);
+			w->recs++;
+		}
+		if (type == DT_DIR) {
+			if (!self && keep) {
+				keep = __atomic_add_fetch(&pool->nparents, 1,
+							__ATOMIC_RELAXED) <= (size_t)RD_MAXFDS * pool->n;
+				if (keep) {
+					self = xmalloc(sizeof(rd_parent));
+					self->fd = dr.fd;
+					self->refs = 1;	// ours, until the dir is read.
+				} else {
+					__atomic_sub_fetch(&pool->nparents, 1,
+										__ATOMIC_RELAXED);
+				}
+			}
+			if (self) __atomic_add_fetch(&self->refs, 1, __ATOMIC_ACQ_REL);
+			__atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+			rd_queue(w, xstrdup(joinbuf), self);
+		}
+	} // while()
+	if (self) {	// the fd is the sub-dirs' now, just free the buffer.
+		free(dr.buf);
+		rd_unref(pool, self);
+	} else {
+		dr_close(&dr);
+	}
+} // rd_scan()
+
+static void
+dq_push(rd_deque *dq, rd_dir *d)
+{ /* Add d at the tail of dq, growing it as needed. */
+	pthread_mutex_lock(&dq->lock);
+	if (dq->tail == dq->size) {
+		if (dq->head) {	// reclaim the space stolen from.
+			memmove(dq->dirs, dq->dirs + dq->head,
+						(dq->tail - dq->head) * sizeof(rd_dir));
+			dq->tail -= dq->head;
+			dq->head = 0;
+		} else {
+			dq->size = (dq->size) ? dq->size * 2 : 64;
+			dq->dirs = realloc(dq->dirs, dq->size * sizeof(rd_dir));
+			if (!dq->dirs) {
+				fputs("Out of memory.\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+	dq->dirs[dq->tail++] = *d;
+	pthread_mutex_unlock(&dq->lock);
+} // dq_push()
+
+static int
+dq_pop(rd_deque *dq, rd_dir *d)
+{ /* Take the newest dir from the tail of dq into d, returns 0 if dq is
+   * empty, else 1.
+*/
+	int ret = 0;
+	pthread_mutex_lock(&dq->lock);
+	if (dq->tail > dq->head) {
+		*d = dq->dirs[--dq->tail];
+		ret = 1;
+	}
+	if (dq->tail == dq->head) dq->head = dq->tail = 0;
+	pthread_mutex_unlock(&dq->lock);
+	return ret;
+} // dq_pop()
+
+static int
+dq_steal(rd_deque *dq, rd_dir *d)
+{ /* Take the oldest dir from the head of dq into d, returns 0 if dq is
+   * empty, else 1. The oldest dirs are the nearest to the root so
+   * probably the most work.
+*/
+	int ret = 0;
+	pthread_mutex_lock(&dq->lock);
+	if (dq->tail > dq->head) {
+		*d = dq->dirs[dq->head++];
+		ret = 1;
+	}
+	pthread_mutex_unlock(&dq->lock);
+	return ret;
+} // dq_steal()
+
 /*
  * For fsobj below use DT_BLK, DT_CHR, DT_DIR, DT_FIFO, DT_LNK, DT_REG,
  * DT_SOCK, DT_UNKNOWN as required.
  * Most needs will be met by DT_DIR and DT_REG.
  * DT_DIR will always be needed else the recursion can never happen.
- * Excludes may be NULL and if it is there will be no dirs excluded from
- * the output.
+ * Excl may be NULL and if it is there will be no dirs excluded from
+ * the output. It belongs to the caller and must outlive rd.
  * */
 
 rd_data
-*init_recursedir(char **excludes, size_t meminc, /*d_type*/...)
+*init_recursedir(excl_t *excl, size_t meminc, /*d_type*/...)
 /* vargs are list of fsobj, must terminate with 0 */
 { /* prepare to use recursedir() */
 	rd_data *rd = xmalloc(sizeof(rd_data));
 	memset(rd, 0, sizeof(rd_data));
 	rd->meminc = meminc;
-	if (excludes) {	// excludes may be NULL
-		size_t i, j, n;
-		for (i = 0; excludes[i] ; i++);
-		n = i + 1;
-		rd->rejectlist = xmalloc(n * sizeof(char *));
-		memset(rd->rejectlist, 0, n * sizeof(char *));
-		for (i = 0, j = 0; i < n; i++) {
-			// deal with non-existence of realpath() some names.
-			char *cp = realpath(excludes[i], NULL);
-			if (cp) rd->rejectlist[j++] = cp;
-		} // for()
-	} // if()
+	rd->nthreads = 1;
+	rd->excl = excl;
 	int i = 0;
 	va_list ap;
 	va_start(ap, meminc);
@@ -111,16 +594,10 @@ rd_data
 } // init_recursedir()
 
 void
-free_recursedir(rd_data *rd, mdata *md)
+free_recursedir(rd_data *rd, sarena *sa)
 { /* free resources allocated by init_recursedir() */
-	if (rd->rejectlist) {
-		int i;
-		for (i = 0; rd->rejectlist[i]; i++) free(rd->rejectlist[i]);
-		free(rd->rejectlist);
-	}
 	free(rd);
-	free(md->fro);
-	free(md);
+	free_sarena(sa);
 } // free_recursedir()
 
 void
@@ -135,17 +612,234 @@ doclosedir(DIR *dp)
 
 void
 newdir(const char *p, int mayexist)
-{ /* mkdir() with error handling. Also have hard wired mode. */
+{ /* mkdir() with error handling. Also have hard wired mode. If mayexist
+   * is set, missing dirs above p are made too, see mkdirp().
+*/
 	if (mayexist) {
-		if(exists_dir(p)) return;
+		mkdirp(p);
+		return;
 	}
 	const int crmode = 0775;	// stat yielded this value.
+	st_add(ST_MKDIR, 1);
 	if (mkdir(p, crmode) == -1) {
 		perror(p);
 		exit(EXIT_FAILURE);
 	}
 } // newdir()
 
+int
+newdirat(int dfd, const char *p)
+{ /* mkdirat() with error handling, hard wired mode as for newdir().
+   * An existing dir is not an error. Returns 1 if the dir was made,
+   * 0 if it was there already.
+*/
+	const int crmode = 0775;
+	st_add(ST_MKDIR, 1);
+	if (mkdirat(dfd, p, crmode) == -1) {
+		if (errno == EEXIST) return 0;
+		perror(p);
+		exit(EXIT_FAILURE);
+	}
+	return 1;
+} // newdirat()
+
+int
+mkdirp(const char *p)
+{ /* Make the dir p and any missing dirs above it, as mkdir -p does, and
+   * return the number made. A dir not known yet is made by mkdirat(),
+   * in its parent's fd if that is kept, with EEXIST counting as success,
+   * so there is no stat() first. Only when mkdirat() fails with ENOENT
+   * is the parent made, the same way. Either way the dir is remembered,
+   * so the next call for it, or for a dir below it, makes no system call
+   * for it at all. Only parents keep an fd. Relative paths are taken from
+   * the current dir. Aborts on error, eg if p or a dir above it exists
+   * but is not a dir.
+*/
+	char path[PATH_MAX];
+	strcpy(path, p);
+	size_t len = strlen(path);
+	while (len > 1 && path[len - 1] == '/') path[--len] = 0;
+	int made = 0;
+	pthread_mutex_lock(&dc_lock);
+	if (!dc_known) dc_known = init_hash(64);
+	dc_dir(path, &made, 0);
+	pthread_mutex_unlock(&dc_lock);
+	return made;
+} // mkdirp()
+
+void
+mkdirp_forget(const char *p)
+{ /* The dir p, and everything under it, may have been removed so drop
+   * them from what mkdirp() knows.
+*/
+	pthread_mutex_lock(&dc_lock);
+	if (!dc_known) {
+		pthread_mutex_unlock(&dc_lock);
+		return;
+	}
+	size_t plen = strlen(p);
+	sarena *gone = init_sarena(0);
+	size_t iter = 0;
+	char *key;
+	void *val;
+	while (hash_next(dc_known, &iter, &key, &val)) {
+		if (strncmp(key, p, plen) != 0) continue;
+		if (key[plen] != 0 && key[plen] != '/') continue;
+		if ((intptr_t)val > 1) close((int)(intptr_t)val - 2);
+		sa_insert(gone, key);
+	}
+	size_t i;
+	for (i = 0; i < gone->count; i++) hash_del(dc_known, gone->index[i]);
+	free_sarena(gone);
+	pthread_mutex_unlock(&dc_lock);
+} // mkdirp_forget()
+
+void
+mkdirp_free(void)
+{ /* free resources allocated by mkdirp() */
+	pthread_mutex_lock(&dc_lock);
+	if (dc_known) {
+		size_t iter = 0;
+		char *key;
+		void *val;
+		while (hash_next(dc_known, &iter, &key, &val)) {
+			if ((intptr_t)val > 1) close((int)(intptr_t)val - 2);
+		}
+		free_hash(dc_known, NULL);
+		dc_known = NULL;
+	}
+	pthread_mutex_unlock(&dc_lock);
+} // mkdirp_free()
+
+static int
+dc_dir(char *path, int *made, int wantfd)
+{ /* The work of mkdirp(). If wantfd is set, path is to be a parent and
+   * its O_PATH fd is kept and returned, else -1 is returned and only
+   * the path is kept. Path is modified during the call but restored.
+*/
+	void *val = hash_get(dc_known, path);
+	int fd = (val) ? (int)(intptr_t)val - 2 : -1;
+	if (fd != -1 || (val && !wantfd)) return fd;
+	char *cp = strrchr(path, '/');
+	const char *name = (cp) ? cp + 1 : path;
+	if (!val && *name) {	// not known yet, make it, it may exist.
+		int pfd = AT_FDCWD;
+		const char *p = path;	// relative to pfd.
+		if (cp) {	// a parent with a kept fd saves the path walk.
+			void *pv;
+			if (cp == path) {
+				pv = hash_get(dc_known, "/");
+			} else {
+				*cp = 0;
+				pv = hash_get(dc_known, path);
+				*cp = '/';
+			}
+			if ((intptr_t)pv > 1) {
+				pfd = (int)(intptr_t)pv - 2;
+				p = name;
+			}
+		}
+		st_add(ST_MKDIR, 1);
+		int ret = mkdirat(pfd, p, 0775);	// mode as for newdir().
+		if (ret == -1 && errno == ENOENT && cp) {	// make the parent.
+			if (cp == path) {
+				pfd = dc_dir("/", made, 1);
+			} else {
+				*cp = 0;
+				pfd = dc_dir(path, made, 1);
+				*cp = '/';
+			}
+			p = name;
+			st_add(ST_MKDIR, 1);
+			ret = mkdirat(pfd, p, 0775);
+		}
+		if (ret == 0) {
+			(*made)++;
+		} else if (errno != EEXIST) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		} else if (!wantfd) {	// it exists, but is it a dir?
+			struct stat sb;
+			st_add(ST_STAT, 1);
+			if (fstatat(pfd, p, &sb, 0) == -1) {
+				perror(path);
+				exit(EXIT_FAILURE);
+			}
+			if (!S_ISDIR(sb.st_mode)) {
+				errno = ENOTDIR;
+				perror(path);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+	if (wantfd) {	// O_DIRECTORY fails with ENOTDIR on a non dir.
+		fd = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+		if (fd == -1) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+	}
+	hash_put(dc_known, path, (void *)(intptr_t)(fd + 2));
+	return fd;
+} // dc_dir()
+
+int
+dopenat(int dfd, const char *p)
+{ /* Open the dir p relative to dfd for use with the *at() functions.
+   * Symlinks are not followed. Aborts on error.
+*/
+	int fd = openat(dfd, p, O_RDONLY | O_DIRECTORY | O_NOFOLLOW
+						| O_CLOEXEC);
+	if (fd == -1) {
+		perror(p);
+		exit(EXIT_FAILURE);
+	}
+	st_add(ST_OPENDIR, 1);
+	return fd;
+} // dopenat()
+
+static void
+rmtreeat(int dfd, const char *name)
+{ /* Remove name from the dir open on dfd, and if it's a dir, all it
+   * holds first. Errors are reported but not fatal.
+*/
+	int fd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW
+						| O_CLOEXEC);
+	if (fd == -1) {	// not a dir, or gone already.
+		if (unlinkat(dfd, name, 0) == -1 && errno != ENOENT)
+			perror(name);
+		return;
+	}
+	DIR *dp = fdopendir(fd);
+	if (!dp) {
+		perror(name);
+		close(fd);
+		return;
+	}
+	struct dirent *de;
+	while ((de = readdir(dp))) {
+		if (strcmp(de->d_name, ".") == 0 ) continue;
+		if (strcmp(de->d_name, "..") == 0) continue;
+		if (de->d_type == DT_DIR || de->d_type == DT_UNKNOWN) {
+			rmtreeat(fd, de->d_name);
+		} else if (unlinkat(fd, de->d_name, 0) == -1) {
+			perror(de->d_name);
+		}
+	}
+	closedir(dp);
+	if (unlinkat(dfd, name, AT_REMOVEDIR) == -1 && errno != ENOENT)
+		perror(name);
+} // rmtreeat()
+
+void
+rmtree(const char *path)
+{ /* Remove path and, if it's a dir, everything under it. Errors are
+   * reported but not fatal, it is not an error if path does not exist.
+*/
+	mkdirp_forget(path);
+	rmtreeat(AT_FDCWD, path);
+} // rmtree()
+
 void
 xchdir(const char *path)
 {/* Just chdir() with error handling. */
@@ -41,21 +41,44 @@
 #include <linux/limits.h>
 #include <libgen.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sys/syscall.h>
 #include "str.h"
 #include "files.h"
+#include "excl.h"
+#include "hash.h"
 
 typedef struct rd_data {
-	char **rejectlist;
-	size_t meminc;
+	excl_t *excl;	// dirs not to be listed or entered, may be NULL.
+	size_t meminc;	// first chunk size of the output arenas.
 	unsigned char fsobj[9];
+	int nthreads;	// worker threads used by recursedir_mt().
+	size_t recs;	// records output so far.
 } rd_data;
 
+#define DR_MINBUF 4096	// a dir's first read buffer,
+#define DR_BUFSIZE (256 * 1024)	// doubled as needed up to this.
+/* Dirs recursedir() keeps open at once, deeper trees reopen by path. */
+#define RD_MAXFDS 32
+
+typedef struct dr_data {	// a dir being read by dr_read().
+	int fd;
+	char *buf;
+	size_t pos, len, size;
+} dr_data;
+
+typedef struct dr_ent {	// one entry, name points into the buffer.
+	ino_t ino;
+	unsigned char type;
+	const char *name;
+} dr_ent;
+
 rd_data
-*init_recursedir(char **excludes, size_t meminc,/*d_type*/ ...);
+*init_recursedir(excl_t *excl, size_t meminc,/*d_type*/ ...);
 /* vargs are list of d_type, must terminate with 0 */
 
 void
-free_recursedir(rd_data *rd, mdata *md);
+free_recursedir(rd_data *rd, sarena *sa);
 
 DIR
 *dopendir(const char *dirname);
@@ -64,11 +87,44 @@ void
 doclosedir(DIR *dp);
 
 int
-recursedir(char *dirname, mdata *ddat, rd_data *rd);
+recursedir(char *dirname, sarena *ddat, rd_data *rd);
+
+int
+recursedir_mt(char *dirname, sarena *ddat, rd_data *rd);
+
+size_t
+pathjoin(char *path, size_t plen, const char *name);
+
+int
+dr_open(dr_data *dr, int dfd, const char *name);
+
+dr_ent
+*dr_read(dr_data *dr, dr_ent *ent);
+
+void
+dr_close(dr_data *dr);
 
 void
 newdir(const char *dname, int mayexist);
 
+int
+newdirat(int dfd, const char *dname);
+
+int
+mkdirp(const char *dname);
+
+void
+mkdirp_forget(const char *dname);
+
+void
+mkdirp_free(void);
+
+int
+dopenat(int dfd, const char *dname);
+
+void
+rmtree(const char *path);
+
 void
 xchdir(const char *);
 
@@ -0,0 +1,145 @@
+/*    excl.c
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of excl.[h|c] is to decide quickly whether a dir is
+ * excluded from processing. See excl.h.
+ * */
+
+#include "excl.h"
+
+static void
+addexact(excl_t *ex, const char *path);
+static void
+addprefix(excl_t *ex, const char *path);
+static ex_node
+*newnode(void);
+static void
+freenode(void *node);
+
+excl_t
+*init_excl(char **list)
+{ /* Compile the NULL terminated list of rules. A rule ending in '/'
+   * excludes that dir and everything under it, otherwise just the path
+   * named. Each rule is entered as written and, if different, as
+   * realpath() has it, so that both forms match. Empty lines are
+   * ignored. List may be NULL.
+*/
+	excl_t *ex = xmalloc(sizeof(excl_t));
+	ex->exact = init_hash(64);
+	ex->root = newnode();
+	ex->nrules = 0;
+	size_t i;
+	for (i = 0; list && list[i]; i++) {
+		char buf[PATH_MAX];
+		size_t len = strlen(list[i]);
+		if (!len || len >= PATH_MAX) continue;
+		strcpy(buf, list[i]);
+		int prefix = (buf[len - 1] == '/');
+		while (len > 1 && buf[len - 1] == '/') buf[--len] = 0;
+		void (*add)(excl_t *, const char *) = (prefix) ? addprefix
+															: addexact;
+		add(ex, buf);
+		char *real = realpath(buf, NULL);
+		if (real) {
+			if (strcmp(real, buf) != 0) add(ex, real);
+			free(real);
+		}
+		ex->nrules++;
+	}
+	return ex;
+} // init_excl()
+
+void
+free_excl(excl_t *ex)
+{ /* free resources allocated by init_excl() */
+	if (!ex) return;
+	free_hash(ex->exact, NULL);
+	freenode(ex->root);
+	free(ex);
+} // free_excl()
+
+int
+excluded(excl_t *ex, const char *path)
+{ /* Return 1 if path is excluded by ex, else 0. Ex may be NULL. */
+	if (!ex || !ex->nrules) return 0;
+	if (hash_get(ex->exact, path)) return 1;
+	ex_node *node = ex->root;
+	if (node->isrule) return 1;
+	const char *cp = path;
+	while (*cp && node->kids) {
+		while (*cp == '/') cp++;
+		if (!*cp) break;
+		const char *end = strchrnul(cp, '/');
+		char comp[NAME_MAX + 1];
+		size_t len = end - cp;
+		if (len > NAME_MAX) return 0;
+		memcpy(comp, cp, len);
+		comp[len] = 0;
+		node = hash_get(node->kids, comp);
+		if (!node) return 0;
+		if (node->isrule) return 1;
+		cp = end;
+	}
+	return 0;
+} // excluded()
+
+static void
+addexact(excl_t *ex, const char *path)
+{ /* Enter path in the set of whole paths. */
+	hash_put(ex->exact, path, (void *)1);
+} // addexact()
+
+static void
+addprefix(excl_t *ex, const char *path)
+{ /* Enter path in the trie, one node per component. */
+	char buf[PATH_MAX];
+	strcpy(buf, path);
+	ex_node *node = ex->root;
+	char *save;
+	char *comp = strtok_r(buf, "/", &save);
+	while (comp) {
+		if (!node->kids) node->kids = init_hash(8);
+		ex_node *kid = hash_get(node->kids, comp);
+		if (!kid) {
+			kid = newnode();
+			hash_put(node->kids, comp, kid);
+		}
+		node = kid;
+		comp = strtok_r(NULL, "/", &save);
+	}
+	node->isrule = 1;
+} // addprefix()
+
+static ex_node
+*newnode(void)
+{ /* A trie node with no kids. */
+	ex_node *node = xmalloc(sizeof(ex_node));
+	node->kids = NULL;
+	node->isrule = 0;
+	return node;
+} // newnode()
+
+static void
+freenode(void *node)
+{ /* Free node and everything under it. */
+	ex_node *n = node;
+	if (n->kids) free_hash(n->kids, freenode);
+	free(n);
+} // freenode()
@@ -0,0 +1,59 @@
+/*    excl.h
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of excl.[h|c] is to decide quickly whether a dir is
+ * excluded from processing. Whole paths are kept in a hash set and
+ * rules naming a dir and all under it, written with a trailing '/',
+ * are kept in a trie of path components. Either way a lookup costs in
+ * proportion to the length of the path, not the number of rules.
+ * */
+
+#ifndef _EXCL_H
+#define _EXCL_H
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include "str.h"
+#include "hash.h"
+
+typedef struct ex_node {	// one component of a prefix rule.
+	hash_t *kids;		// component name to ex_node, NULL if none.
+	int isrule;			// the path to here is excluded, and all under.
+} ex_node;
+
+typedef struct excl_t {
+	hash_t *exact;		// paths excluded, but not what is under them.
+	ex_node *root;
+	size_t nrules;
+} excl_t;
+
+excl_t
+*init_excl(char **list);
+
+void
+free_excl(excl_t *ex);
+
+int
+excluded(excl_t *ex, const char *path);
+
+#endif
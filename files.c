@@ -25,6 +25,9 @@
 
 #include "files.h"
 
+static int
+copydata(int in, int out, off_t size);
+
 void
 writestrarray(char **list)
 { /* output the strings to console - must be NULL terminated. */
@@ -162,7 +165,8 @@ writefile(const char *filename, char *fro, char *to, const char *fmode)
 	*/
 	off_t len = to - fro;
 	if (len <= 0) return;
-	if (!instrlist("w", "a", (char *)NULL)) {
+	char *modes[] = { "w", "a", (char *)NULL };
+	if (!instrlist(fmode, modes)) {
 		fprintf(stderr, "Invalid mode: %s\n", fmode);
 		exit(EXIT_FAILURE);
 	}
@@ -206,6 +210,7 @@ mdata
 		FILE *fp = dofopen(path, "r");
 		size_t bread = fread(ret->fro, 1, fsize, fp);
 		dofclose(fp);
+		st_add(ST_READBYTES, bread);
 		if (bread != fsize) {
 			fprintf(stderr,
 			"Expected to get %lu bytes, but got %lu bytes.\n",
@@ -221,6 +226,57 @@ mdata
 	return ret;
 } //readfile()
 
+mdata
+*mapfile(const char *path, int fatal)
+{	/* As for readfile() but the file is mapped, not copied, so pages are
+	 * read only as they are touched. The mapping is private, the caller
+	 * may write to it, eg memlinestostr(), without changing the file.
+	 * There is no room beyond the end of the file, md->limit == md->to.
+	 * Release with unmapfile(), not free_mdata().
+	*/
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		if (!fatal && errno == ENOENT) return NULL;
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	struct stat sb;
+	if (fstat(fd, &sb) == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	if (!S_ISREG(sb.st_mode)) {
+		close(fd);
+		if (!fatal) return NULL;
+		fprintf(stderr, "Not a regular file: %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	mdata *ret = xmalloc(sizeof(mdata));
+	ret->fro = ret->to = ret->limit = NULL;
+	st_add(ST_READBYTES, sb.st_size);
+	if (sb.st_size) {	// mmap() can't map 0 bytes.
+		void *p = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE,
+						MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+		madvise(p, sb.st_size, MADV_SEQUENTIAL);
+		ret->fro = p;
+		ret->to = ret->limit = ret->fro + sb.st_size;
+	}
+	close(fd);
+	return ret;
+} // mapfile()
+
+void
+unmapfile(mdata *md)
+{	/* free resources allocated by mapfile() */
+	if (!md) return;
+	if (md->fro) munmap(md->fro, md->limit - md->fro);
+	free(md);
+} // unmapfile()
+
 int
 exists_file(const char *path)
 {	/* returns 1 if I can stat the object and it's a regular file,
@@ -263,12 +319,108 @@ mdata
 
 void
 copyfile(const char *pathfro, const char *pathto)
-{/* Does a file copy in user space. */
-	mdata *fd = readfile(pathfro, 1, 0);
-	writefile(pathto, fd->fro, fd->to, "w");
-	free_mdata(fd);
+{/* Copy a file, in the kernel if it can be done there. */
+	if (copyfileat(AT_FDCWD, pathfro, AT_FDCWD, pathto) == -1) {
+		perror(pathto);
+		exit(EXIT_FAILURE);
+	}
 } // copyfile()
 
+int
+copyfileat(int sfd, const char *sname, int dfd, const char *dname)
+{/* Copy sname in sfd to dname in dfd without the data passing through
+  * user memory: a reflink, ioctl(FICLONE), if the file system can share
+  * the extents, else copy_file_range(), else sendfile(). The copy is
+  * made under a temporary name and renamed into place, so dname is
+  * replaced whole or not at all, and it gets the mode and times of the
+  * source. The temporary name is in the same dir as dname, which may
+  * be a path, so the rename never crosses file systems. Returns the
+  * method used, CP_*, or -1 with errno set.
+*/
+	static unsigned long seq;
+	int in = openat(sfd, sname, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (in == -1) return -1;
+	struct stat sb;
+	if (fstat(in, &sb) == -1) {
+		close(in);
+		return -1;
+	}
+	char tmp[PATH_MAX];
+	const char *slash = strrchr(dname, '/');
+	int dlen = (slash) ? slash - dname + 1 : 0;
+	if (snprintf(tmp, PATH_MAX, "%.*s.csmanager.%ld.%lu", dlen, dname,
+			(long)getpid(), __atomic_add_fetch(&seq, 1, __ATOMIC_RELAXED))
+			>= PATH_MAX) {
+		close(in);
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	int out = openat(dfd, tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+						0600);
+	if (out == -1) {
+		close(in);
+		return -1;
+	}
+	st_add(ST_COPY, 1);
+	int method = copydata(in, out, sb.st_size);
+	struct timespec times[2] = { sb.st_atim, sb.st_mtim };
+	if (method != -1 && (fchmod(out, sb.st_mode & 07777) == -1
+		|| futimens(out, times) == -1)) method = -1;
+	if (close(out) == -1) method = -1;
+	if (method != -1 && renameat(dfd, tmp, dfd, dname) == -1) method = -1;
+	int err = errno;
+	if (method == -1) unlinkat(dfd, tmp, 0);
+	close(in);
+	errno = err;
+	return method;
+} // copyfileat()
+
+pid_t
+copytemp_pid(const char *name)
+{/* If name is that of a temporary copy made by copyfileat(), return the
+  * pid of the process that made it, else 0. A copy of a run that was
+  * killed is left behind under such a name.
+*/
+	static const char prefix[] = ".csmanager.";
+	if (strncmp(name, prefix, sizeof(prefix) - 1)) return 0;
+	const char *cp = name + sizeof(prefix) - 1;
+	char *ep;
+	long pid = strtol(cp, &ep, 10);
+	if (ep == cp || *ep != '.' || pid <= 0) return 0;
+	cp = ep + 1;
+	strtoul(cp, &ep, 10);
+	if (ep == cp || *ep) return 0;
+	return pid;
+} // copytemp_pid()
+
+static int
+copydata(int in, int out, off_t size)
+{/* Copy size bytes from in to out for copyfileat(), trying each method
+  * in turn until one is supported. Returns the method used or -1.
+*/
+	if (ioctl(out, FICLONE, in) == 0) return CP_CLONE;
+	int method = CP_RANGE;
+	off_t left = size;
+	while (left > 0) {
+		ssize_t n = copy_file_range(in, NULL, out, NULL, left, 0);
+		if (n == -1 && left == size && (errno == EXDEV || errno == ENOSYS
+			|| errno == EINVAL || errno == EOPNOTSUPP)) {
+			method = CP_SENDFILE;	// nothing done yet, try the next.
+			break;
+		}
+		if (n == 0) errno = EIO;	// the source shrank.
+		if (n <= 0) return -1;
+		left -= n;
+	}
+	while (method == CP_SENDFILE && left > 0) {
+		ssize_t n = sendfile(out, in, NULL, left);
+		if (n == 0) errno = EIO;
+		if (n <= 0) return -1;
+		left -= n;
+	}
+	return method;
+} // copydata()
+
 void
 dolink(const char *fr, const char *to)
 {/* link() with error handling. */
@@ -279,26 +431,18 @@ dolink(const char *fr, const char *to)
 	}
 } // dolink()
 
-char
-*cfg_getparameter(const char *prn, const char *fn, const char *param)
-{ /* Return the string that param points to. */
-	mdata *md = getconfigfile(prn, fn);
-	memlinestostr(md);
-	char *p = memmem(md->fro, md->to - md->fro, param, strlen(param));
-	if (!p) {
-		fprintf(stderr, "No such parameter: %s\n", param);
-		free_mdata(md);
-		exit(EXIT_FAILURE);
-	}
-	char *eq = strchr(p, '=');
-	if (!eq) {
-		fprintf(stderr, "Malformed parameter line: %s\n", p);
-		free_mdata(md);
+int
+dolinkat(int frofd, const char *fr, int tofd, const char *to)
+{/* linkat() with error handling. Returns 0 on success or -1 if 'to'
+  * already exists so the caller can decide what to do about it. All
+  * other errors are fatal as for dolink().
+*/
+	st_add(ST_LINK, 1);
+	if (linkat(frofd, fr, tofd, to, 0) == -1) {
+		if (errno == EEXIST) return -1;
+		perror(to);
+		perror(fr);
 		exit(EXIT_FAILURE);
 	}
-	eq++;	// get past '='
-	trimspace(eq);
-	char *ret = xstrdup(eq);
-	free_mdata(md);
-	return ret;
-} // cfg_getparameter()
+	return 0;
+} // dolinkat()
@@ -30,6 +30,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -71,6 +75,12 @@ str2file(const char *fn, const char *s, const char *mode);
 mdata
 *readfile(const char *fn, int fatal, size_t extra);
 
+mdata
+*mapfile(const char *fn, int fatal);
+
+void
+unmapfile(mdata *md);
+
 FILE
 *dofopen(const char *fn, const char *opnmode);
 
@@ -95,10 +105,18 @@ mdata
 void
 copyfile(const char *pathfro, const char *pathto);
 
+enum { CP_CLONE = 1, CP_RANGE, CP_SENDFILE };	// copyfileat() methods.
+
+int
+copyfileat(int sfd, const char *sname, int dfd, const char *dname);
+
+pid_t
+copytemp_pid(const char *name);
+
 void
 dolink(const char *fro, const char *to);
 
-char
-*cfg_getparameter(const char *prn, const char *fn, const char *param);
+int
+dolinkat(int frofd, const char *fro, int tofd, const char *to);
 
 #endif
@@ -23,12 +23,15 @@
 #include "str.h"
 #include "gopt.h"
 
+char *optstring;
+char *helptext;
+char *synopsis;
 
 options_t process_options(int argc, char **argv)
 {
 	synopsis = thesynopsis();
 	helptext = thehelp();
-	optstring = ":hd:f:c:";
+	optstring = ":hd:Df:c:wj:uprPR";
 
 	/* declare and set defaults for local variables. */
 
@@ -47,6 +50,15 @@ options_t process_options(int argc, char **argv)
 		{"dirs-from",		1,	0,	'd'}, /* a file, list of dirs */
 		{"dot-files-dir",	1,	0,	'f'}, /* hidden dirs synced here */
 		{"cloud-target",	1,	0,	'c'}, /* name of cloud dir */
+		{"watch",			0,	0,	'w'}, /* link changes as they happen */
+		{"threads",			1,	0,	'j'}, /* threads to read trees */
+		{"uring",			0,	0,	'u'}, /* batch syscalls via io_uring */
+		{"plan",			0,	0,	'p'}, /* show what would be done */
+		{"stats",			2,	0,	0},   /* counts and times on exit */
+		{"reconcile",		0,	0,	'r'}, /* remove orphaned targets */
+		{"dot-files",		0,	0,	'D'}, /* tarball the dot dirs */
+		{"pipeline",		0,	0,	'P'}, /* link while finding dirs */
+		{"resume",			0,	0,	'R'}, /* go on from a killed run */
 		{0,	0,	0,	0}
 		};
 
@@ -59,6 +71,16 @@ options_t process_options(int argc, char **argv)
 		switch (c) {
 		case 0:
 			switch (option_index) {
+			case 8:	// --stats[=json]
+				if (!optarg || strcmp(optarg, "text") == 0) {
+					opts.stats = ST_TEXT;
+				} else if (strcmp(optarg, "json") == 0) {
+					opts.stats = ST_JSON;
+				} else {
+					fprintf(stderr, "Unknown stats format: %s\n", optarg);
+					dohelp(1);
+				}
+				break;
 			} // switch()
 		break;
 		case 'h':
@@ -67,12 +89,40 @@ options_t process_options(int argc, char **argv)
 		case 'd':
 			opts.dirs_from = xstrdup(optarg);
 			break;
+		case 'D':
+			opts.dot_files = 1;
+			break;
 		case 'f':
 			opts.dot_files_dir = xstrdup(optarg);
 			break;
 		case 'c':
 			opts.cloud_target = xstrdup(optarg);	// --cloud-target
 			break;
+		case 'w':
+			opts.watch = 1;
+			break;
+		case 'j':
+			opts.threads = strtol(optarg, NULL, 10);
+			if (opts.threads < 1) {
+				fprintf(stderr, "Threads must be 1 or more: %s\n", optarg);
+				dohelp(1);
+			}
+			break;
+		case 'u':
+			opts.uring = 1;
+			break;
+		case 'p':
+			opts.plan = 1;
+			break;
+		case 'r':
+			opts.reconcile = 1;
+			break;
+		case 'P':
+			opts.pipeline = 1;
+			break;
+		case 'R':
+			opts.resume = 1;
+			break;
 		case ':':
 			fprintf(stderr, "Option %s requires an argument\n",
 					argv[this_option_optind]);
@@ -106,8 +156,7 @@ char *thesynopsis(void)
   "$HOME/nextcloud/. The dirs to be synced by default, are all named "
   "dirs\n\tin $HOME that are not prefixed with '.' ie hidden dirs.\n"
   "\tThe program creates required dirs under nextcloud/ and then\n\t"
-  "executes synclink to make hard links to of all files from the "
-  "named\n\tdirs."
+  "makes hard links to all files from the named dirs."
   "\n\n";
 	return ret;
 } // thesynopsis()
@@ -123,22 +172,73 @@ char *thehelp(void)
   "dir in\n\t$HOME. This is especially useful for users taking "
   "advantage of\n\tfree sites made available to users with small "
   "storage needs.\n\n"
-  "\t-D, --dot-files \n"
-  "\tWhen selected this option causes the program to check the dot "
-  "dirs\n\tunder $HOME and any such dirs that have files newer than "
-  "when this was\n\tlast run will be tarballed and copied into the "
-  "dot-files-dir.\n\n"
-  "\t-l, --dot-files-dir dir_name\n"
-  "\tBy default dot files tarballs are copied into $HOME/dotty. "
-  "You can name\n\tanother dir for this purpose. However, this is "
-  "not a persistent change.\n\tThe tarballs storing dot dirs data "
-  "are eg named like this:\n\t$HOME/.config/ becomes "
-  "$HOME/dotty/config.tgz and so on.\n\n"
+  "\t-D, --dot-files\n"
+  "\tInstead of linking the dot dirs under $HOME, put each one that "
+  "has\n\tanything newer than $HOME/dottim, or has no tarball yet, into "
+  "a\n\tcompressed tarball in the dot-files-dir. Pigz is used if "
+  "installed,\n\telse gzip. Dirs excluded from linking are left out.\n\n"
+  "\t-f, --dot-files-dir dir_name\n"
+  "\tBy default dot dirs go to $HOME/Nextcloud/Dotty. You can name "
+  "another\n\tdir under the cloud dir for this purpose. However, this "
+  "is not a\n\tpersistent change. With -D the tarballs are named like "
+  "this:\n\t$HOME/.config/ becomes $HOME/Nextcloud/Dotty/config.tgz "
+  "and so on.\n\n"
+  "\t-c, --cloud-target name[:dot_dir][,name[:dot_dir]]...\n"
+  "\tThe cloud dir under $HOME, Nextcloud by default. Give several, "
+  "comma\n\tseparated, to mirror the same tree into each in the one "
+  "pass, eg\n\t-c Nextcloud,Dropbox:Dots. A dot_dir after the colon "
+  "overrides the\n\tdot-files-dir for that target alone.\n\n"
+  "\t-w, --watch\n"
+  "\tAfter linking, keep running and watch the source dirs. New files"
+  " and dirs\n\tare linked as they appear and removed from the target "
+  "when removed\n\tfrom the source. Runs until interrupted.\n\n"
+  "\t-j, --threads number\n"
+  "\tThe number of threads used to read source trees. The default is "
+  "the\n\tnumber of CPUs online.\n\n"
+  "\t-u, --uring\n"
+  "\tBatch the stat, mkdir and link calls made while linking through "
+  "io_uring.\n\tIf the kernel does not support it the usual calls "
+  "are made instead.\n\n"
+  "\t-P, --pipeline\n"
+  "\tLink each dir as soon as it is found, by -j threads, rather than "
+  "finding\n\tall the dirs first and linking one at a time. Sub-dirs "
+  "are shared among\n\tthe threads too. At most pipeline_depth dirs "
+  "wait at once. Ignored\n\twith -p, and --stats then has no times "
+  "for each top level dir.\n\n"
+  "\t-p, --plan\n"
+  "\tChange nothing, instead print one tab separated line for each dir "
+  "that\n\twould be made and each file that would be linked, relinked "
+  "or copied,\n\twith its size, and each target file that has no "
+  "source. A total line\n\tcomes last.\n\n"
+  "\t-r, --reconcile\n"
+  "\tAfter linking, remove target files whose source has been deleted "
+  "or\n\trenamed, then target dirs left empty whose source has gone. "
+  "Only files\n\tthe manifest shows were linked or copied by this "
+  "program are removed.\n\tWith -p the removals are only listed.\n\n"
+  "\t-R, --resume\n"
+  "\tGo on from a run that was killed before it completed, with the "
+  "same\n\tsource dir, targets and -d list. Top level dirs it linked "
+  "are skipped,\n\tcopies it left cut short in the dirs it was "
+  "linking are removed and\n\tthose dirs are linked again. With no "
+  "such run, start afresh.\n\n"
+  "\t--stats[=json]\n"
+  "\tOn exit print to stderr the number of dirs opened, getdents, stat,"
+  "\n\tmkdir and link calls, copies, bytes read and data block growth,"
+  "\n\twith the time spent in each phase and each top level dir. As "
+  "text, or\n\tas JSON if json is given.\n\n"
   "\tFILES\n"
   "\tThere is a file $HOME/dottim the modification time of which is "
-  "set to\n\tthe time of completion of the last dot-files run. Initially "
-  "this file\n\tis dated '1970-01-01' so that all dot dirs are tarballed"
-  " on the first\n\ttime the option is selected.\n"
+  "set to\n\tthe time the last dot-files run started. Until it exists "
+  "all dot dirs\n\tare tarballed, as on the first time the option is "
+  "selected.\n"
+  "\tSettings are read once from $HOME/.config/csmanager/csmanager.cfg,"
+  "\n\tlines of 'name = value': threads, the default for -j, "
+  "uring_entries,\n\tthe io_uring ring size, default 256, "
+  "pipeline_depth, the dirs that\n\tmay wait for -P, default 64, and "
+  "journal_batch, the journal records\n\twritten between syncs to disk, "
+  "default 256. With -w, SIGHUP reloads it.\n"
+  "\tWhile linking, $HOME/.config/csmanager/journal records what has "
+  "been\n\tdone, for -R. It is removed when the run completes.\n"
   ;
 	return ret;
 } // thehelp()
@@ -20,14 +20,23 @@
 
 #ifndef GOPT_H
 #define GOPT_H
-char *optstring;
-char *helptext;
-char *synopsis;
+extern char *optstring;
+extern char *helptext;
+extern char *synopsis;
 
 typedef struct options_t {	// to be initialised with required vars.
 	char	*dirs_from;		// -d, --dirs-from
 	char	*dot_files_dir;	// -f, --dot-files-dir
+	int		dot_files;		// -D, --dot-files
 	char	*cloud_target;	// -c, --cloud-target
+	int		watch;			// -w, --watch
+	int		threads;		// -j, --threads
+	int		uring;			// -u, --uring
+	int		plan;			// -p, --plan
+	int		reconcile;		// -r, --reconcile
+	int		stats;			// --stats[=json], ST_TEXT or ST_JSON.
+	int		pipeline;		// -P, --pipeline
+	int		resume;			// -R, --resume
 } options_t;
 
 void dohelp(int forced);
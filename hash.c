@@ -0,0 +1,179 @@
+/*    hash.c
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of hash.[h|c] is to provide a hash table keyed by C
+ * strings. Open addressing with linear probing, the table is doubled
+ * whenever it becomes 3/4 full. Keys are copied into the table, values
+ * are whatever pointer the caller likes and belong to the caller.
+ * */
+
+#include "hash.h"
+
+static size_t
+findslot(hash_t *h, const char *key);
+static void
+growhash(hash_t *h);
+
+hash_t
+*init_hash(size_t nominal)
+{ /* Make an empty table big enough for nominal keys before growing. */
+	hash_t *h = xmalloc(sizeof(hash_t));
+	size_t size = 16;
+	while (size < nominal + nominal / 3) size *= 2;
+	h->size = size;
+	h->count = 0;
+	h->keys = xmalloc(size * sizeof(char *));
+	memset(h->keys, 0, size * sizeof(char *));
+	h->vals = xmalloc(size * sizeof(void *));
+	return h;
+} // init_hash()
+
+void
+free_hash(hash_t *h, void (*freeval)(void *))
+{ /* Free the table and its keys. If freeval is not NULL it is applied
+   * to every value.
+*/
+	size_t i;
+	for (i = 0; i < h->size; i++) {
+		if (!h->keys[i]) continue;
+		free(h->keys[i]);
+		if (freeval) freeval(h->vals[i]);
+	}
+	free(h->keys);
+	free(h->vals);
+	free(h);
+} // free_hash()
+
+uint64_t
+strhash(const char *s)
+{ /* FNV-1a, 64 bit. */
+	uint64_t hv = 0xcbf29ce484222325ULL;
+	const unsigned char *cp = (const unsigned char *)s;
+	while (*cp) {
+		hv ^= *cp++;
+		hv *= 0x100000001b3ULL;
+	}
+	return hv;
+} // strhash()
+
+void
+*hash_get(hash_t *h, const char *key)
+{ /* Return the value stored against key, NULL if there is none. */
+	size_t i = findslot(h, key);
+	return (h->keys[i]) ? h->vals[i] : NULL;
+} // hash_get()
+
+void
+*hash_put(hash_t *h, const char *key, void *val)
+{ /* Store val against key. Returns the value that was replaced, or
+   * NULL if key is new.
+*/
+	size_t i = findslot(h, key);
+	if (h->keys[i]) {
+		void *old = h->vals[i];
+		h->vals[i] = val;
+		return old;
+	}
+	h->keys[i] = xstrdup((char *)key);
+	h->vals[i] = val;
+	h->count++;
+	if (h->count * 4 > h->size * 3) growhash(h);
+	return NULL;
+} // hash_put()
+
+void
+*hash_del(hash_t *h, const char *key)
+{ /* Remove key from the table and return its value, NULL if key was
+   * not there. Later members of the probe run are shifted back so that
+   * no tombstones are needed.
+*/
+	size_t mask = h->size - 1;
+	size_t i = findslot(h, key);
+	if (!h->keys[i]) return NULL;
+	void *old = h->vals[i];
+	free(h->keys[i]);
+	h->keys[i] = NULL;
+	h->count--;
+	size_t j = i;
+	while (1) {
+		j = (j + 1) & mask;
+		if (!h->keys[j]) break;
+		size_t home = strhash(h->keys[j]) & mask;
+		/* Move j back to i unless its home lies cyclically in (i, j]. */
+		int stays = (i <= j) ? (i < home && home <= j)
+							: (i < home || home <= j);
+		if (stays) continue;
+		h->keys[i] = h->keys[j];
+		h->vals[i] = h->vals[j];
+		h->keys[j] = NULL;
+		i = j;
+	}
+	return old;
+} // hash_del()
+
+int
+hash_next(hash_t *h, size_t *iter, char **key, void **val)
+{ /* Step through the table. Set *iter to 0 to begin, returns 0 when
+   * there are no more members. The table must not be changed while
+   * stepping through it.
+*/
+	while (*iter < h->size) {
+		size_t i = (*iter)++;
+		if (!h->keys[i]) continue;
+		if (key) *key = h->keys[i];
+		if (val) *val = h->vals[i];
+		return 1;
+	}
+	return 0;
+} // hash_next()
+
+static size_t
+findslot(hash_t *h, const char *key)
+{ /* Return the slot holding key, or the empty slot where it belongs. */
+	size_t mask = h->size - 1;
+	size_t i = strhash(key) & mask;
+	while (h->keys[i] && strcmp(h->keys[i], key) != 0) {
+		i = (i + 1) & mask;
+	}
+	return i;
+} // findslot()
+
+static void
+growhash(hash_t *h)
+{ /* Double the table and rehash all the keys into it. */
+	size_t oldsize = h->size;
+	char **oldkeys = h->keys;
+	void **oldvals = h->vals;
+	h->size *= 2;
+	h->keys = xmalloc(h->size * sizeof(char *));
+	memset(h->keys, 0, h->size * sizeof(char *));
+	h->vals = xmalloc(h->size * sizeof(void *));
+	size_t mask = h->size - 1;
+	size_t i;
+	for (i = 0; i < oldsize; i++) {
+		if (!oldkeys[i]) continue;
+		size_t j = strhash(oldkeys[i]) & mask;
+		while (h->keys[j]) j = (j + 1) & mask;
+		h->keys[j] = oldkeys[i];
+		h->vals[j] = oldvals[i];
+	}
+	free(oldkeys);
+	free(oldvals);
+} // growhash()
@@ -0,0 +1,64 @@
+/*    hash.h
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of hash.[h|c] is to provide a hash table keyed by C
+ * strings. Open addressing with linear probing, the table is doubled
+ * whenever it becomes 3/4 full. Keys are copied into the table, values
+ * are whatever pointer the caller likes and belong to the caller.
+ * */
+
+#ifndef _HASH_H
+#define _HASH_H
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "str.h"
+
+typedef struct hash_t {
+	char **keys;
+	void **vals;
+	size_t size;	// slots, always a power of 2.
+	size_t count;	// slots in use.
+} hash_t;
+
+hash_t
+*init_hash(size_t nominal);
+
+void
+free_hash(hash_t *h, void (*freeval)(void *));
+
+uint64_t
+strhash(const char *s);
+
+void
+*hash_get(hash_t *h, const char *key);
+
+void
+*hash_put(hash_t *h, const char *key, void *val);
+
+void
+*hash_del(hash_t *h, const char *key);
+
+int
+hash_next(hash_t *h, size_t *iter, char **key, void **val);
+
+#endif
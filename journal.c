@@ -0,0 +1,217 @@
+/*    journal.c
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of journal.[h|c] is to let a run that was killed part way
+ * be resumed. See journal.h for the file format.
+ * */
+
+#include "journal.h"
+
+static int
+jn_load(jn_t *jn, char **header, manifest *mf);
+static void
+jn_write(jn_t *jn, char type, const char *path, int now);
+static void
+jn_sync(jn_t *jn);
+static void
+jn_logdir(void *arg, const char *path, mf_dir *md);
+
+jn_t
+*open_journal(const char *prname, char **header, manifest *mf,
+				int resume, size_t batch)
+{ /* Start the journal of a run into $HOME/.config/prname/journal. The
+   * header lines, NULL ended, say who the run is for. If resume is set
+   * and there is a journal with the same header, it is read first and
+   * the run goes on from where it left off, else a new one is begun.
+   * From now on every record stored in mf is journaled too. Batch is
+   * the number of records between syncs to disk.
+*/
+	char fn[PATH_MAX];
+	sprintf(fn, "%s/.config/%s/journal", getenv("HOME"), prname);
+	jn_t *jn = xmalloc(sizeof(jn_t));
+	memset(jn, 0, sizeof(jn_t));
+	jn->fn = xstrdup(fn);
+	jn->batch = (batch) ? batch : 1;
+	jn->mf = mf;
+	jn->done = init_hash(64);
+	pthread_mutex_init(&jn->lock, NULL);
+	if (resume) {
+		if (jn_load(jn, header, mf) == 0) {
+			jn->resumed = 1;
+		} else if (exists_file(fn)) {
+			fprintf(stderr, "%s is of another run, starting afresh.\n", fn);
+		} else {
+			fprintf(stderr, "No run to resume, starting afresh.\n");
+		}
+	}
+	jn->fp = dofopen(fn, (jn->resumed) ? "a" : "w");
+	if (!jn->resumed) {
+		size_t i;
+		for (i = 0; header[i]; i++) fprintf(jn->fp, "H %s\n", header[i]);
+	}
+	jn_sync(jn);
+	mf->logarg = jn;
+	mf->logdir = jn_logdir;
+	return jn;
+} // open_journal()
+
+int
+jn_isdone(jn_t *jn, const char *path)
+{ /* Return 1 if the run resumed completed the top level dir path. */
+	return hash_get(jn->done, path) != NULL;
+} // jn_isdone()
+
+void
+jn_begin(jn_t *jn, const char *path)
+{ /* Record that the top level dir path is about to be linked. It is on
+   * disk before this returns.
+*/
+	jn_write(jn, 'B', path, 1);
+} // jn_begin()
+
+void
+jn_end(jn_t *jn, const char *path)
+{ /* Record that the top level dir path is linked into every target. */
+	jn_write(jn, 'C', path, 0);
+} // jn_end()
+
+void
+close_journal(jn_t *jn, int complete)
+{ /* Stop journaling and free jn. If the run is complete, and so the
+   * manifest has been saved, the journal is removed, else it is kept
+   * for a later --resume.
+*/
+	jn->mf->logdir = NULL;
+	jn->mf->logarg = NULL;
+	jn_sync(jn);
+	dofclose(jn->fp);
+	if (complete && unlink(jn->fn) == -1) {
+		perror(jn->fn);
+		exit(EXIT_FAILURE);
+	}
+	free_hash(jn->done, NULL);
+	if (jn->inflight) destroystrarray(jn->inflight, 0);
+	pthread_mutex_destroy(&jn->lock);
+	free(jn->fn);
+	free(jn);
+} // close_journal()
+
+static int
+jn_load(jn_t *jn, char **header, manifest *mf)
+{ /* Read the journal of a killed run into jn and mf, then cut off any
+   * record it can't trust so that new ones are appended after the last
+   * it can. Returns -1 if there is no journal or its header is not the
+   * one given, else 0.
+*/
+	mdata *md = mapfile(jn->fn, 0);
+	if (!md) return -1;
+	size_t n = memlinestostr(md);	// a last line with no '\n' is lost.
+	char **lines = xmalloc((n + 1) * sizeof(char *));
+	char *cp = md->fro;
+	size_t i, h;
+	for (i = 0; i < n; i++) {
+		lines[i] = cp;
+		cp += strlen(cp) + 1;
+	}
+	for (h = 0; header[h]; h++) {
+		if (h == n || strncmp(lines[h], "H ", 2)
+			|| strcmp(lines[h] + 2, header[h])) break;
+	}
+	if (header[h] || (h < n && lines[h][0] == 'H')) {
+		free(lines);
+		unmapfile(md);
+		return -1;
+	}
+	size_t end = n;	// drop a dir record at the end, it may be short.
+	while (end > h && lines[end - 1][0] && strchr("fdg", lines[end - 1][0]))
+		end--;
+	if (end > h && lines[end - 1][0] == 'D') {
+		end--;
+	} else {
+		end = n;
+	}
+	hash_t *begun = init_hash(64);
+	mf_dir *cur = NULL;
+	for (i = h; i < end; i++) {
+		char *line = lines[i];
+		if (strncmp(line, "B ", 2) == 0) {
+			hash_put(begun, line + 2, (void *)1);
+		} else if (strncmp(line, "C ", 2) == 0) {
+			hash_put(jn->done, line + 2, (void *)1);
+		} else if (mf_readline(mf, line, &cur, 1) == -1) {
+			fprintf(stderr, "Malformed line in %s: %s\n", jn->fn, line);
+			break;
+		}
+	}
+	mf_readline(mf, NULL, &cur, 1);
+	end = i;
+	sarena *sa = init_sarena(0);
+	size_t iter = 0;
+	char *key;
+	void *val;
+	while (hash_next(begun, &iter, &key, &val)) {
+		if (!hash_get(jn->done, key)) sa_insert(sa, key);
+	}
+	jn->inflight = sa_toarray(sa);
+	free_sarena(sa);
+	free_hash(begun, NULL);
+	off_t keep = (end) ? lines[end - 1] + strlen(lines[end - 1]) + 1 - md->fro
+				: 0;
+	free(lines);
+	unmapfile(md);
+	if (truncate(jn->fn, keep) == -1) {
+		perror(jn->fn);
+		exit(EXIT_FAILURE);
+	}
+	return 0;
+} // jn_load()
+
+static void
+jn_write(jn_t *jn, char type, const char *path, int now)
+{ /* Append a record of type for path, syncing if now is set or the
+   * batch is full. A path with a '\n' in it can't be recorded, its dir
+   * will just be done again on resume.
+*/
+	if (strchr(path, '\n')) return;
+	pthread_mutex_lock(&jn->lock);
+	fprintf(jn->fp, "%c %s\n", type, path);
+	if (now || ++jn->unsynced >= jn->batch) jn_sync(jn);
+	pthread_mutex_unlock(&jn->lock);
+} // jn_write()
+
+static void
+jn_sync(jn_t *jn)
+{ /* Put everything written so far on disk. */
+	if (fflush(jn->fp) == EOF || fdatasync(fileno(jn->fp)) == -1) {
+		perror(jn->fn);
+		exit(EXIT_FAILURE);
+	}
+	jn->unsynced = 0;
+} // jn_sync()
+
+static void
+jn_logdir(void *arg, const char *path, mf_dir *md)
+{ /* The manifest's logdir(), journal the dir record md. */
+	jn_t *jn = arg;
+	pthread_mutex_lock(&jn->lock);
+	if (mf_writedir(jn->fp, path, md) == 0 && ++jn->unsynced >= jn->batch)
+		jn_sync(jn);
+	pthread_mutex_unlock(&jn->lock);
+} // jn_logdir()
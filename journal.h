@@ -0,0 +1,87 @@
+/*    journal.h
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of journal.[h|c] is to let a run that was killed part way
+ * be resumed, with --resume, rather than started again. The journal is
+ * kept as $HOME/.config/csmanager/journal while a run links, and is
+ * removed when the run completes. It is only ever appended to, one line
+ * per record:
+ * H text		who the run was for, the source dir and targets.
+ * B /path		linking of the top level dir began.
+ * C /path		it completed, into every target.
+ * D ... f ...	a dir record, as in the manifest, each as it was made.
+ * A 'B' is synced to disk before its dir is touched, so any dir that a
+ * killed run may have left half done is known. The other records are
+ * synced in batches, losing some only means redoing some work.
+ *
+ * On resume the dir records are put into the manifest so that dirs
+ * already linked are not read again, completed top level dirs are not
+ * visited at all, and the targets of those begun but not completed can
+ * be repaired. The record being written when the run was killed may be
+ * cut short, so a dir record at the end of the journal is not trusted.
+ * */
+
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <errno.h>
+#include <pthread.h>
+#include "str.h"
+#include "files.h"
+#include "hash.h"
+#include "manifest.h"
+
+typedef struct jn_t {
+	char *fn;			// where it's kept.
+	FILE *fp;			// appended to.
+	pthread_mutex_t lock;	// records are written from any thread.
+	size_t batch;		// records between syncs.
+	size_t unsynced;	// records written since the last sync.
+	manifest *mf;		// its dir records are journaled.
+	int resumed;		// the journal of a killed run was read.
+	hash_t *done;		// top level dirs that run completed.
+	char **inflight;	// and those it began and didn't, NULL ended.
+} jn_t;
+
+jn_t
+*open_journal(const char *prname, char **header, manifest *mf,
+				int resume, size_t batch);
+
+int
+jn_isdone(jn_t *jn, const char *path);
+
+void
+jn_begin(jn_t *jn, const char *path);
+
+void
+jn_end(jn_t *jn, const char *path);
+
+void
+close_journal(jn_t *jn, int complete);
+
+#endif
@@ -0,0 +1,841 @@
+/*    linker.c
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of linker.[h|c] is to mirror a source dir onto a target
+ * dir as a tree of hard links. It replaces running the external
+ * synclink program once per dir.
+ * */
+
+#include "linker.h"
+
+typedef struct lk_ent {	// an entry of the source dir being linked.
+	char *name;
+	ino_t ino;
+	unsigned char type;
+	int havestat;
+	struct stat sb;
+	int res;			// of the last queued operation, 0 or -errno.
+	ino_t tino;			// the target entry of the same name, 0 if none.
+	unsigned char ttype;
+	ino_t cino;			// a copy's own inode in the first target.
+	int failed;			// not linked to, or copied into, every target.
+} lk_ent;
+
+static void
+linkdir(int sfd, int *dfds, char *path, lk_data *lk);
+static void
+linktarget(int sfd, int dfd, int samedev, int first, lk_ent *ents,
+			size_t nents, char *path, mf_dir *old, lk_data *lk);
+static void
+targetstat(int *dfds, dev_t *tdevs, struct stat *tsb, char *path,
+			lk_data *lk);
+static int
+isstop(lk_data *lk, ino_t ino);
+static void
+linkknown(int sfd, int *dfds, char *path, mf_dir *md, lk_data *lk);
+static void
+descend(int sfd, int *dfds, const char *name, char *path, lk_data *lk);
+static int
+linkfile(int sfd, const char *sname, int dfd, const char *dname,
+			char *path, lk_data *lk);
+static int
+relink(int sfd, const char *sname, int dfd, const char *dname,
+			char *path, lk_data *lk);
+static int
+copyin(int sfd, const char *sname, int dfd, const char *dname,
+			struct stat *ssb, char *path, lk_data *lk);
+static lk_ent
+*readents(int sfd, char *path, size_t *nents);
+static void
+statents(int sfd, lk_ent *ents, size_t nents, int wantreg, lk_data *lk);
+static void
+mergeents(lk_ent *ents, size_t nents, lk_ent *tents, size_t ntents);
+static void
+stxtostat(const struct statx *stx, struct stat *sb);
+static void
+lk_mkdirat(lk_data *lk, int dfd, const char *name, int *res);
+static void
+lk_linkat(lk_data *lk, int sfd, const char *sname, int dfd,
+			const char *dname, int *res);
+static void
+plandir(int sfd, int dfd, dev_t tdev, char *path, char *dpath,
+			lk_data *lk);
+static void
+plan_orphans(int dfd, lk_ent *ents, size_t nents, char *dpath,
+				size_t dlen, lk_data *lk);
+static int
+entcmp(const void *a, const void *b);
+
+lk_data
+*init_linker(char **cloud_targets, manifest *mf, int verbose)
+{ /* Prepare to use synctree(). Cloud_targets is a NULL terminated list
+   * of the targets, each tree is mirrored to all of them. They are
+   * recorded so that a source tree which contains one can never be
+   * linked into it. The manifest, mf, may be NULL and if it is every
+   * dir will be read.
+*/
+	lk_data *lk = xmalloc(sizeof(lk_data));
+	memset(lk, 0, sizeof(lk_data));
+	lk->verbose = verbose;
+	lk->mf = mf;
+	while (cloud_targets[lk->ntargets]) {
+		const char *t = cloud_targets[lk->ntargets];
+		if (lk->ntargets == LK_MAXTARGETS) {
+			fprintf(stderr, "No more than %d cloud targets.\n",
+					LK_MAXTARGETS);
+			exit(EXIT_FAILURE);
+		}
+		if (exists_dir(t)) lk->stopino[lk->ntargets] = getinode(t);
+		lk->ntargets++;
+	}
+	return lk;
+} // init_linker()
+
+void
+free_linker(lk_data *lk)
+{ /* free resources allocated by init_linker() */
+	free_uring(lk->ur);
+	if (lk->planned) free_hash(lk->planned, NULL);
+	free(lk);
+} // free_linker()
+
+void
+synctree(const char *srcdir, char **dstdirs, lk_data *lk)
+{ /* Hard link every regular file under srcdir to the same relative
+   * place under each of dstdirs, one per cloud target, creating dirs
+   * under them as needed. The dstdirs must exist.
+*/
+	char path[PATH_MAX];
+	strcpy(path, srcdir);
+	int dfds[LK_MAXTARGETS];
+	size_t k;
+	int sfd = dopenat(AT_FDCWD, srcdir);
+	for (k = 0; k < lk->ntargets; k++)
+		dfds[k] = dopenat(AT_FDCWD, dstdirs[k]);
+	linkdir(sfd, dfds, path, lk);
+	for (k = 0; k < lk->ntargets; k++) close(dfds[k]);
+} // synctree()
+
+void
+synctreeat(int sfd, int *dfds, char *path, lk_data *lk)
+{ /* As synctree() for a source dir and its targets that are already
+   * open. Takes ownership of all the fds. Path names the source dir in
+   * a buffer of PATH_MAX, it is used as the working path.
+*/
+	size_t k;
+	linkdir(sfd, dfds, path, lk);
+	for (k = 0; k < lk->ntargets; k++) close(dfds[k]);
+} // synctreeat()
+
+int
+linkpath(const char *src, char **dsts, lk_data *lk)
+{ /* Link the single file src to each of dsts, one per cloud target, as
+   * synctree() would. Returns 0 if every dst is a link to src when
+   * done, -1 otherwise.
+*/
+	char path[PATH_MAX];
+	int res = 0;
+	size_t k;
+	for (k = 0; k < lk->ntargets; k++) {
+		strcpy(path, src);
+		if (linkfile(AT_FDCWD, src, AT_FDCWD, dsts[k], path, lk) == -1)
+			res = -1;
+	}
+	return res;
+} // linkpath()
+
+lk_data
+*clone_linker(lk_data *lk)
+{ /* A linker with the settings of lk, and the same manifest, but counts
+   * of its own and no ring, for another thread. Merge_linker() adds its
+   * counts back into lk and frees it.
+*/
+	lk_data *c = xmalloc(sizeof(lk_data));
+	memset(c, 0, sizeof(lk_data));
+	c->verbose = lk->verbose;
+	c->ntargets = lk->ntargets;
+	memcpy(c->stopino, lk->stopino, sizeof(lk->stopino));
+	c->skipino = lk->skipino;
+	c->mf = lk->mf;
+	c->spawn = lk->spawn;
+	c->pl = lk->pl;
+	return c;
+} // clone_linker()
+
+void
+merge_linker(lk_data *lk, lk_data *from)
+{ /* Add the counts of from, made by clone_linker(), to lk and free it. */
+	size_t i;
+	lk->ndirs += from->ndirs;
+	lk->nlinks += from->nlinks;
+	lk->nrelinks += from->nrelinks;
+	lk->nskips += from->nskips;
+	lk->nunchanged += from->nunchanged;
+	for (i = 0; i < sizeof(lk->ncopies) / sizeof(lk->ncopies[0]); i++)
+		lk->ncopies[i] += from->ncopies[i];
+	lk->ncopyins += from->ncopyins;
+	lk->nxdev += from->nxdev;
+	free_linker(from);
+} // merge_linker()
+
+void
+plantree(const char *srcdir, const char *dstdir, lk_data *lk)
+{ /* What synctree() would do, without changing anything. Every step is
+   * printed as one line of tab separated fields, the action first:
+   *	mkdir	dst
+   *	link	bytes	src	dst
+   *	relink	bytes	src	dst		dst replaced by a link to src.
+   *	copy	bytes	src	dst		dst on another file system.
+   *	orphan	bytes	dst			dst has no source, left alone.
+   * Dstdir, and any dirs above it, need not exist.
+*/
+	char path[PATH_MAX], dpath[PATH_MAX];
+	strcpy(path, srcdir);
+	strcpy(dpath, dstdir);
+	struct stat sb;
+	dev_t tdev = 0;
+	if (!lk->planned) lk->planned = init_hash(64);
+	/* Plan to make the missing dirs above dstdir, and learn the device
+	 * the target will be on from the nearest one that exists. */
+	size_t len = strlen(dpath);
+	while (len && stat(dpath, &sb) == -1) {
+		while (len && dpath[len] != '/') len--;
+		dpath[len] = 0;
+	}
+	tdev = (len) ? sb.st_dev : 0;
+	while (len < strlen(dstdir)) {
+		dpath[len] = dstdir[len];
+		len++;
+		if (dstdir[len] == '/' || dstdir[len] == 0) {
+			dpath[len] = 0;
+			if (!hash_get(lk->planned, dpath)) {
+				hash_put(lk->planned, dpath, (void *)1);
+				printf("mkdir\t%s\n", dpath);
+				lk->ndirs++;
+			}
+		}
+	}
+	strcpy(dpath, dstdir);
+	int sfd = dopenat(AT_FDCWD, srcdir);
+	int dfd = open(dstdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	plandir(sfd, dfd, tdev, path, dpath, lk);
+	if (dfd != -1) close(dfd);
+} // plantree()
+
+void
+linker_report(lk_data *lk)
+{ /* Summary of the work done by synctree(), or planned by plantree(). */
+	if (lk->plan) {	// the last line of the plan, same format.
+		printf("total\tdirs=%lu\tlinks=%lu\trelinks=%lu\tcopies=%lu\t"
+				"unchanged=%lu\torphans=%lu\tbytes=%lld\n", lk->ndirs,
+				lk->nlinks, lk->nrelinks, lk->ncopyins, lk->nskips,
+				lk->norphans, lk->nbytes);
+		return;
+	}
+	printf("Dirs made: %lu, links made: %lu, relinked: %lu, "
+			"already linked: %lu, unchanged dirs: %lu\n", lk->ndirs,
+			lk->nlinks, lk->nrelinks, lk->nskips, lk->nunchanged);
+	if (lk->ncopies[CP_CLONE] || lk->ncopies[CP_RANGE] ||
+		lk->ncopies[CP_SENDFILE]) {
+		printf("Copied, not linked: reflinked: %lu, copy_file_range: %lu, "
+				"sendfile: %lu\n", lk->ncopies[CP_CLONE],
+				lk->ncopies[CP_RANGE], lk->ncopies[CP_SENDFILE]);
+	}
+} // linker_report()
+
+static void
+linkdir(int sfd, int *dfds, char *path, lk_data *lk)
+{ /* Link the content of the dir open on sfd into each target dir open
+   * on dfds, one per target, and recurse into sub-dirs. Takes ownership
+   * of sfd, but not dfds. Path names the source dir, it is extended and
+   * restored in place as we descend. The source dir is read once
+   * whatever the number of targets. If there is a manifest and neither
+   * the source dir nor its targets have changed since the last run,
+   * only the sub-dirs are visited.
+*/
+	struct stat sb, tsb;
+	mf_dir *old = NULL, *new = NULL;
+	size_t i, k;
+	dev_t tdevs[LK_MAXTARGETS];
+	if (fstat(sfd, &sb) == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	targetstat(dfds, tdevs, &tsb, path, lk);
+	if (lk->mf) {
+		old = mf_getdir(lk->mf, path);
+		if (old && mf_samedir(old, &sb, &tsb)) {
+			linkknown(sfd, dfds, path, old, lk);
+			return;
+		}
+		new = mf_newdir(&sb, &tsb);
+	}
+	size_t nents;
+	lk_ent *ents = readents(sfd, path, &nents);
+	qsort(ents, nents, sizeof(lk_ent), entcmp);
+	statents(sfd, ents, nents, new != NULL, lk);
+	if (lk->skipino) {	// left out, as if it were not there.
+		for (k = 0; k < nents; k++) {
+			if (ents[k].type == DT_REG && ents[k].ino == lk->skipino)
+				ents[k].type = DT_UNKNOWN;
+		}
+	}
+	/* Trust the old record of a file only if the target dirs are
+	 * unchanged too. */
+	int trust = (old && old->tmtime == new->tmtime);
+	size_t nxdev = lk->nxdev;
+	for (k = 0; k < lk->ntargets; k++) {
+		linktarget(sfd, dfds[k], sb.st_dev == tdevs[k], k == 0, ents,
+					nents, path, (trust) ? old : NULL, lk);
+	}
+	size_t plen = strlen(path);
+	for (i = 0; i < nents; i++) {
+		lk_ent *e = &ents[i];
+		if (new && e->type == DT_REG && e->havestat) {
+			ino_t tino = (e->failed) ? 0
+						: (e->cino) ? e->cino : e->sb.st_ino;
+			mf_addkid(new, e->name, 'f', &e->sb, tino);
+		}
+		if (e->type != DT_DIR || isstop(lk, e->ino)) continue;
+		strjoin(path, '/', e->name, PATH_MAX);
+		descend(sfd, dfds, e->name, path, lk);
+		if (new) {
+			mf_addkid(new, e->name, 'd', NULL, 0);
+			new->kids[new->nkids - 1].st.ino = e->ino;
+		}
+		path[plen] = 0;
+	}
+	if (new) {	// our own work changed the targets.
+		targetstat(dfds, tdevs, &tsb, path, lk);
+		new->tmtime = mf_nsecs(&tsb.st_mtim);
+		/* A copy, unlike a link, doesn't follow edits to its source,
+		 * which needn't change the dir mtime, so a dir holding copies
+		 * must be read every run. No target dir has an mtime of 0. */
+		if (lk->nxdev != nxdev) new->tmtime = 0;
+		mf_putdir(lk->mf, path, new);
+	}
+	for (i = 0; i < nents; i++) free(ents[i].name);
+	free(ents);
+	close(sfd);
+} // linkdir()
+
+static void
+linktarget(int sfd, int dfd, int samedev, int first, lk_ent *ents,
+			size_t nents, char *path, mf_dir *old, lk_data *lk)
+{ /* Link the files of ents, sorted by name, from the dir open on sfd
+   * into the one target dir open on dfd, and make the sub-dirs there.
+   * Samedev is set if they are on the same file system, first for the
+   * first target, whose copies are the ones recorded. Old is the record
+   * of the dir if it can be trusted, else NULL.
+   * The target dir is read and merged with ents by name. A file whose
+   * target entry has the same inode is already linked and costs
+   * nothing more. Only missing files are linked, and only names that
+   * hold something else go to relink().
+   * The work is done in batches, every mkdir() and link() then their
+   * results, so that with io_uring each batch is one submission.
+*/
+	size_t ntents;
+	lk_ent *tents = readents(dfd, path, &ntents);
+	mergeents(ents, nents, tents, ntents);
+	size_t i;
+	for (i = 0; i < ntents; i++) free(tents[i].name);
+	free(tents);
+	for (i = 0; i < nents; i++) {
+		lk_ent *e = &ents[i];
+		if (e->type == DT_DIR) {
+			if (isstop(lk, e->ino)) continue;
+			if (e->ttype == DT_DIR) {
+				e->res = -EEXIST;	// made on an earlier run.
+			} else {
+				lk_mkdirat(lk, dfd, e->name, &e->res);
+			}
+		} else if (e->type == DT_REG) {
+			mf_kid *kid = (old) ? mf_findkid(old, e->name) : NULL;
+			if (kid && e->havestat && mf_samefile(kid, &e->sb)) {
+				lk->nskips++;
+				e->res = 1;	// nothing to do.
+			} else if (samedev && e->tino == e->ino) {
+				lk->nskips++;
+				e->res = 1;	// already a link to the source.
+			} else if (e->tino) {
+				e->res = -EEXIST;	// something else, relink() it.
+			} else {
+				lk_linkat(lk, sfd, e->name, dfd, e->name, &e->res);
+			}
+		}
+	}
+	if (lk->ur) ur_flush(lk->ur);
+	size_t plen = strlen(path);
+	for (i = 0; i < nents; i++) {
+		lk_ent *e = &ents[i];
+		if (e->type == DT_DIR) {
+			if (isstop(lk, e->ino)) continue;
+			if (e->res == 0) {
+				lk->ndirs++;
+			} else if (e->res != -EEXIST) {
+				strjoin(path, '/', e->name, PATH_MAX);
+				fprintf(stderr, "%s: %s\n", path, strerror(-e->res));
+				exit(EXIT_FAILURE);
+			}
+			continue;
+		}
+		if (e->type != DT_REG) continue;
+		strjoin(path, '/', e->name, PATH_MAX);
+		int linked = 1;
+		size_t before = lk->nxdev;
+		if (e->res == 0) {
+			lk->nlinks++;
+			if (lk->verbose) printf("Linked: %s\n", path);
+		} else if (e->res == -EEXIST) {
+			linked = (relink(sfd, e->name, dfd, e->name, path, lk) == 0);
+		} else if (e->res == -EXDEV || e->res == -EMLINK) {
+			linked = (copyin(sfd, e->name, dfd, e->name, NULL, path,
+								lk) == 0);
+		} else if (e->res < 0) {
+			fprintf(stderr, "%s: %s\n", path, strerror(-e->res));
+			exit(EXIT_FAILURE);
+		}
+		if (!linked) e->failed = 1;
+		if (first && linked && lk->nxdev != before) {	// its own inode.
+			struct stat dsb;
+			st_add(ST_STAT, 1);
+			e->cino = (fstatat(dfd, e->name, &dsb, AT_SYMLINK_NOFOLLOW)
+						== 0) ? dsb.st_ino : 0;
+			if (!e->cino) e->failed = 1;
+		}
+		path[plen] = 0;
+	}
+} // linktarget()
+
+static void
+targetstat(int *dfds, dev_t *tdevs, struct stat *tsb, char *path,
+			lk_data *lk)
+{ /* Put the device of each target dir open on dfds in tdevs, and in
+   * tsb the stat of the first with its inode and mtime mixed with those
+   * of the others, so that a manifest record of one dir covers all its
+   * targets. With one target tsb is just its stat.
+*/
+	struct stat sb;
+	unsigned long long ino = 0, mtime = 0;
+	size_t k;
+	for (k = 0; k < lk->ntargets; k++) {
+		if (fstat(dfds[k], (k) ? &sb : tsb) == -1) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+		if (k == 0) sb = *tsb;
+		tdevs[k] = sb.st_dev;
+		unsigned long long m = mf_nsecs(&sb.st_mtim);
+		ino = (ino << 7 | ino >> 57) ^ sb.st_ino;
+		mtime = (mtime << 13 | mtime >> 51) ^ m;
+	}
+	if (lk->ntargets > 1) {
+		long long t = mtime;
+		tsb->st_ino = ino;
+		tsb->st_mtim.tv_sec = t / 1000000000LL;
+		tsb->st_mtim.tv_nsec = t % 1000000000LL;
+	}
+} // targetstat()
+
+static int
+isstop(lk_data *lk, ino_t ino)
+{ /* Return 1 if ino is that of a cloud target, never to be entered. */
+	size_t k;
+	for (k = 0; k < lk->ntargets; k++) {
+		if (lk->stopino[k] == ino) return 1;
+	}
+	return 0;
+} // isstop()
+
+static lk_ent
+*readents(int sfd, char *path, size_t *nents)
+{ /* Return every entry of the dir open on sfd, except . and .., and
+   * put the count in nents. Sfd stays open for the *at() calls.
+*/
+	dr_data dr;
+	if (dr_open(&dr, sfd, ".") == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	size_t n = 0, size = 64;
+	lk_ent *ents = xmalloc(size * sizeof(lk_ent));
+	dr_ent ent, *de;
+	while ((de = dr_read(&dr, &ent))) {
+		if (n == size) {
+			size *= 2;
+			ents = realloc(ents, size * sizeof(lk_ent));
+			if (!ents) {
+				fputs("Out of memory.\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+		}
+		lk_ent *e = &ents[n++];
+		memset(e, 0, sizeof(lk_ent));
+		e->name = xstrdup((char *)de->name);
+		e->ino = de->ino;
+		e->type = de->type;
+	}
+	dr_close(&dr);
+	*nents = n;
+	return ents;
+} // readents()
+
+static void
+statents(int sfd, lk_ent *ents, size_t nents, int wantreg, lk_data *lk)
+{ /* Stat the entries whose type is unknown, and the regular files too
+   * if wantreg is set, ie a manifest record is being made. Entries that
+   * vanished since being read get type DT_UNKNOWN and are ignored.
+*/
+	struct statx *stx = NULL;
+	if (lk->ur) stx = xmalloc(nents * sizeof(struct statx));
+	size_t i;
+	for (i = 0; i < nents; i++) {
+		lk_ent *e = &ents[i];
+		if (e->type != DT_UNKNOWN && !(wantreg && e->type == DT_REG))
+			continue;
+		e->havestat = 1;
+		st_add(ST_STAT, 1);
+		if (lk->ur) {
+			ur_statx(lk->ur, sfd, e->name, &stx[i], &e->res);
+		} else {
+			e->res = (fstatat(sfd, e->name, &e->sb, AT_SYMLINK_NOFOLLOW)
+						== -1) ? -errno : 0;
+		}
+	}
+	if (lk->ur) ur_flush(lk->ur);
+	for (i = 0; i < nents; i++) {
+		lk_ent *e = &ents[i];
+		if (!e->havestat) continue;
+		if (e->res != 0) {	// gone since readdir()
+			e->havestat = 0;
+			e->type = DT_UNKNOWN;
+			continue;
+		}
+		if (stx) stxtostat(&stx[i], &e->sb);
+		e->type = IFTODT(e->sb.st_mode);
+	}
+	free(stx);
+} // statents()
+
+static void
+mergeents(lk_ent *ents, size_t nents, lk_ent *tents, size_t ntents)
+{ /* Sort the target entries, tents, by name and walk them together with
+   * the source entries, ents, sorted already, giving each source entry
+   * the inode number and type of the target entry of the same name.
+*/
+	qsort(tents, ntents, sizeof(lk_ent), entcmp);
+	size_t i, j = 0;
+	for (i = 0; i < nents; i++) {	// from the last target.
+		ents[i].tino = 0;
+		ents[i].ttype = DT_UNKNOWN;
+	}
+	i = 0;
+	while (i < nents && j < ntents) {
+		int cmp = strcmp(ents[i].name, tents[j].name);
+		if (cmp < 0) {
+			i++;
+		} else if (cmp > 0) {
+			j++;
+		} else {
+			ents[i].tino = tents[j].ino;
+			ents[i].ttype = tents[j].type;
+			i++;
+			j++;
+		}
+	}
+} // mergeents()
+
+static void
+stxtostat(const struct statx *stx, struct stat *sb)
+{ /* Copy the fields of stx that the linker uses into sb. */
+	memset(sb, 0, sizeof(struct stat));
+	sb->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	sb->st_ino = stx->stx_ino;
+	sb->st_mode = stx->stx_mode;
+	sb->st_nlink = stx->stx_nlink;
+	sb->st_size = stx->stx_size;
+	sb->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+	sb->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+} // stxtostat()
+
+static void
+lk_mkdirat(lk_data *lk, int dfd, const char *name, int *res)
+{ /* Queue mkdirat() if there is a ring, otherwise do it now. Either
+   * way *res gets 0 or -errno.
+*/
+	const int crmode = 0775;	// as for newdirat()
+	st_add(ST_MKDIR, 1);
+	if (lk->ur) {
+		ur_mkdirat(lk->ur, dfd, name, crmode, res);
+	} else {
+		*res = (mkdirat(dfd, name, crmode) == -1) ? -errno : 0;
+	}
+} // lk_mkdirat()
+
+static void
+lk_linkat(lk_data *lk, int sfd, const char *sname, int dfd,
+			const char *dname, int *res)
+{ /* Queue linkat() if there is a ring, otherwise do it now. Either way
+   * *res gets 0 or -errno.
+*/
+	st_add(ST_LINK, 1);
+	if (lk->ur) {
+		ur_linkat(lk->ur, sfd, sname, dfd, dname, res);
+	} else {
+		*res = (linkat(sfd, sname, dfd, dname, 0) == -1) ? -errno : 0;
+	}
+} // lk_linkat()
+
+static void
+linkknown(int sfd, int *dfds, char *path, mf_dir *md, lk_data *lk)
+{ /* The dir open on sfd is unchanged since md was recorded, so only
+   * the sub-dirs it had then need to be visited. Takes ownership of
+   * sfd, but not dfds.
+*/
+	size_t plen = strlen(path);
+	size_t i;
+	for (i = 0; i < md->nkids; i++) {
+		mf_kid *kid = &md->kids[i];
+		if (kid->type != 'd') continue;
+		if (isstop(lk, kid->st.ino)) continue;
+		strjoin(path, '/', kid->name, PATH_MAX);
+		descend(sfd, dfds, kid->name, path, lk);
+		path[plen] = 0;
+	}
+	md->seen = 1;
+	lk->nunchanged++;
+	close(sfd);
+} // linkknown()
+
+static void
+descend(int sfd, int *dfds, const char *name, char *path, lk_data *lk)
+{ /* Link the sub-dir name of the dir open on sfd into the sub-dir of
+   * the same name in each of dfds. Path names the sub-dir. It is offered
+   * to lk->spawn() first, if set, and only linked here if not taken.
+*/
+	int cdfds[LK_MAXTARGETS];
+	size_t k;
+	int csfd = dopenat(sfd, name);
+	for (k = 0; k < lk->ntargets; k++) cdfds[k] = dopenat(dfds[k], name);
+	if (lk->spawn && lk->spawn(lk->pl, csfd, cdfds, path) == 0) return;
+	linkdir(csfd, cdfds, path, lk);
+	for (k = 0; k < lk->ntargets; k++) close(cdfds[k]);
+} // descend()
+
+static int
+linkfile(int sfd, const char *sname, int dfd, const char *dname,
+			char *path, lk_data *lk)
+{ /* Link sname from sfd to dname in dfd. If the target name already
+   * exists and is not a link to the source file it gets replaced. If
+   * no link can be made the file is copied. Returns 0 if the target is
+   * a link to, or copy of, the source when done, -1 otherwise.
+*/
+	st_add(ST_LINK, 1);
+	if (linkat(sfd, sname, dfd, dname, 0) == 0) {
+		lk->nlinks++;
+		if (lk->verbose) printf("Linked: %s\n", path);
+		return 0;
+	}
+	if (errno == EEXIST) return relink(sfd, sname, dfd, dname, path, lk);
+	if (errno == EXDEV || errno == EMLINK)
+		return copyin(sfd, sname, dfd, dname, NULL, path, lk);
+	perror(path);
+	exit(EXIT_FAILURE);
+} // linkfile()
+
+static int
+relink(int sfd, const char *sname, int dfd, const char *dname,
+			char *path, lk_data *lk)
+{ /* Dname in dfd exists, replace it by a link to sname from sfd unless
+   * it already is one. Returns as for linkfile().
+*/
+	struct stat ssb, dsb;
+	st_add(ST_STAT, 2);
+	if (fstatat(sfd, sname, &ssb, AT_SYMLINK_NOFOLLOW) == -1) {
+		perror(path);
+		return -1;
+	}
+	if (fstatat(dfd, dname, &dsb, AT_SYMLINK_NOFOLLOW) == -1) {
+		if (errno == ENOENT)	// removed since the target was read.
+			return linkfile(sfd, sname, dfd, dname, path, lk);
+		perror(path);
+		return -1;
+	}
+	if (ssb.st_dev == dsb.st_dev && ssb.st_ino == dsb.st_ino) {
+		lk->nskips++;
+		return 0;
+	}
+	if (ssb.st_dev != dsb.st_dev)	// no link possible, maybe a copy.
+		return copyin(sfd, sname, dfd, dname, &ssb, path, lk);
+	if (unlinkat(dfd, dname, 0) == -1) {	// eg a dir by the same name.
+		perror(path);
+		return -1;
+	}
+	if (dolinkat(sfd, sname, dfd, dname) == -1) {	// made meanwhile.
+		return relink(sfd, sname, dfd, dname, path, lk);
+	}
+	lk->nrelinks++;
+	if (lk->verbose) printf("Relinked: %s\n", path);
+	return 0;
+} // relink()
+
+static int
+copyin(int sfd, const char *sname, int dfd, const char *dname,
+			struct stat *ssb, char *path, lk_data *lk)
+{ /* Dname in dfd can't be a link to sname in sfd, so make it a copy,
+   * unless it already is one with the same size and mtime. Ssb is the
+   * stat of the source, NULL if not known yet. Returns as for
+   * linkfile().
+*/
+	struct stat sb, dsb;
+	lk->nxdev++;
+	if (!ssb) {
+		st_add(ST_STAT, 1);
+		if (fstatat(sfd, sname, &sb, AT_SYMLINK_NOFOLLOW) == -1) {
+			perror(path);
+			return -1;
+		}
+		ssb = &sb;
+	}
+	st_add(ST_STAT, 1);
+	if (fstatat(dfd, dname, &dsb, AT_SYMLINK_NOFOLLOW) == 0 &&
+		S_ISREG(dsb.st_mode) && dsb.st_size == ssb->st_size &&
+		mf_nsecs(&dsb.st_mtim) == mf_nsecs(&ssb->st_mtim)) {
+		lk->nskips++;
+		return 0;
+	}
+	int method = copyfileat(sfd, sname, dfd, dname);
+	if (method == -1) {
+		perror(path);
+		return -1;
+	}
+	lk->ncopies[method]++;
+	lk->ncopyins++;
+	if (lk->verbose) printf("Copied: %s\n", path);
+	return 0;
+} // copyin()
+
+static void
+plandir(int sfd, int dfd, dev_t tdev, char *path, char *dpath,
+			lk_data *lk)
+{ /* The part of plantree() for one dir, open on sfd. Dfd is its target,
+   * -1 if that doesn't exist yet, and tdev the device the target is or
+   * will be on. Takes ownership of sfd, but not dfd.
+*/
+	struct stat sb;
+	if (dfd != -1) {
+		if (fstat(dfd, &sb) == -1) {
+			perror(dpath);
+			exit(EXIT_FAILURE);
+		}
+		tdev = sb.st_dev;
+	}
+	size_t nents;
+	lk_ent *ents = readents(sfd, path, &nents);
+	statents(sfd, ents, nents, 1, lk);
+	qsort(ents, nents, sizeof(lk_ent), entcmp);
+	size_t plen = strlen(path), dlen = strlen(dpath);
+	size_t i;
+	for (i = 0; i < nents; i++) {
+		lk_ent *e = &ents[i];
+		if (e->type != DT_REG) continue;
+		pathjoin(path, plen, e->name);
+		pathjoin(dpath, dlen, e->name);
+		struct stat dsb;
+		if (dfd != -1) st_add(ST_STAT, 1);
+		int have = (dfd != -1 &&
+				fstatat(dfd, e->name, &dsb, AT_SYMLINK_NOFOLLOW) == 0);
+		const char *act = NULL;
+		if (have && dsb.st_dev == e->sb.st_dev
+			&& dsb.st_ino == e->sb.st_ino) {
+			lk->nskips++;
+		} else if (tdev != e->sb.st_dev) {
+			if (have && S_ISREG(dsb.st_mode)
+				&& dsb.st_size == e->sb.st_size
+				&& mf_nsecs(&dsb.st_mtim) == mf_nsecs(&e->sb.st_mtim)) {
+				lk->nskips++;
+			} else {
+				act = "copy";
+				lk->ncopyins++;
+			}
+		} else if (have) {
+			act = "relink";
+			lk->nrelinks++;
+		} else {
+			act = "link";
+			lk->nlinks++;
+		}
+		if (act) {
+			printf("%s\t%lld\t%s\t%s\n", act, (long long)e->sb.st_size,
+					path, dpath);
+			lk->nbytes += e->sb.st_size;
+		}
+	}
+	if (dfd != -1) plan_orphans(dfd, ents, nents, dpath, dlen, lk);
+	for (i = 0; i < nents; i++) {
+		lk_ent *e = &ents[i];
+		if (e->type != DT_DIR || isstop(lk, e->ino)) continue;
+		pathjoin(path, plen, e->name);
+		pathjoin(dpath, dlen, e->name);
+		int cdfd = (dfd == -1) ? -1 : openat(dfd, e->name,
+					O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (cdfd == -1) {
+			printf("mkdir\t%s\n", dpath);
+			lk->ndirs++;
+		}
+		plandir(dopenat(sfd, e->name), cdfd, tdev, path, dpath, lk);
+		if (cdfd != -1) close(cdfd);
+	}
+	path[plen] = 0;
+	dpath[dlen] = 0;
+	for (i = 0; i < nents; i++) free(ents[i].name);
+	free(ents);
+	close(sfd);
+} // plandir()
+
+static void
+plan_orphans(int dfd, lk_ent *ents, size_t nents, char *dpath,
+				size_t dlen, lk_data *lk)
+{ /* Report the files in the target dir open on dfd that have no source
+   * in ents, which must be sorted by name.
+*/
+	size_t ntents;
+	lk_ent *tents = readents(dfd, dpath, &ntents);
+	statents(dfd, tents, ntents, 1, lk);
+	size_t i;
+	for (i = 0; i < ntents; i++) {
+		lk_ent *t = &tents[i];
+		if (t->type == DT_REG &&
+			!bsearch(t, ents, nents, sizeof(lk_ent), entcmp)) {
+			pathjoin(dpath, dlen, t->name);
+			printf("orphan\t%lld\t%s\n", (long long)t->sb.st_size, dpath);
+			lk->norphans++;
+		}
+		free(t->name);
+	}
+	dpath[dlen] = 0;
+	free(tents);
+} // plan_orphans()
+
+static int
+entcmp(const void *a, const void *b)
+{ /* qsort() and bsearch() order of lk_ent by name. */
+	return strcmp(((const lk_ent *)a)->name, ((const lk_ent *)b)->name);
+} // entcmp()
@@ -0,0 +1,103 @@
+/*    linker.h
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of linker.[h|c] is to mirror a source dir onto a target
+ * dir as a tree of hard links. It replaces running the external
+ * synclink program once per dir. Where a link can't be made, eg the
+ * target is on another file system, the file is copied instead.
+ * */
+
+#ifndef _LINKER_H
+#define _LINKER_H
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <errno.h>
+#include "str.h"
+#include "dirs.h"
+#include "files.h"
+#include "manifest.h"
+#include "uring.h"
+
+#define LK_MAXTARGETS 8	// cloud targets a tree can be mirrored to.
+
+typedef struct lk_data {
+	int verbose;		// report every link made.
+	size_t ntargets;	// each tree is mirrored to this many targets.
+	ino_t stopino[LK_MAXTARGETS];	// never descend into these, eg Nextcloud.
+	ino_t skipino;		// never link this file, eg the journal being written.
+	manifest *mf;		// what was linked last run, may be NULL.
+	ur_data *ur;		// batch the system calls if not NULL.
+	size_t ndirs;		// target dirs created.
+	size_t nlinks;		// new links made.
+	size_t nrelinks;	// stale target files replaced by a link.
+	size_t nskips;		// files already linked.
+	size_t nunchanged;	// dirs not read because the manifest says so.
+	size_t ncopies[4];	// copied not linked, indexed by CP_* method.
+	size_t ncopyins;	// files copied, by any method.
+	size_t nxdev;		// files that had to be copies, made or not.
+	int plan;			// plantree() is used, the counts are of a plan.
+	size_t norphans;	// target files with no source, plan only.
+	long long nbytes;	// size of the files a plan would link or copy.
+	hash_t *planned;	// dirs a plan has made already.
+	/* If set, each sub-dir is offered to spawn() before being linked in
+	 * line. It returns 0 if it has taken the dir, and its fds, for some
+	 * other thread to link. Pl is its first argument. */
+	int (*spawn)(void *pl, int sfd, int *dfds, const char *path);
+	void *pl;
+} lk_data;
+
+lk_data
+*init_linker(char **cloud_targets, manifest *mf, int verbose);
+
+void
+free_linker(lk_data *lk);
+
+void
+synctree(const char *srcdir, char **dstdirs, lk_data *lk);
+
+void
+plantree(const char *srcdir, const char *dstdir, lk_data *lk);
+
+void
+synctreeat(int sfd, int *dfds, char *path, lk_data *lk);
+
+int
+linkpath(const char *src, char **dsts, lk_data *lk);
+
+lk_data
+*clone_linker(lk_data *lk);
+
+void
+merge_linker(lk_data *lk, lk_data *from);
+
+void
+linker_report(lk_data *lk);
+
+#endif
@@ -0,0 +1,375 @@
+/*    manifest.c
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of manifest.[h|c] is to remember, from one run to the
+ * next, what the source dirs held when they were last linked. See
+ * manifest.h for the file format.
+ * */
+
+#include "manifest.h"
+
+static void
+free_mfdir(void *p);
+static int
+kidcmp(const void *a, const void *b);
+static char
+*parsestat(char *cp, mf_stat *st, long long *extra);
+static void
+writestat(FILE *fpo, char type, mf_stat *st, long long extra,
+			const char *name);
+static void
+keepgone(mf_dir *md, mf_dir *old);
+
+manifest
+*load_manifest(const char *prname)
+{ /* Read $HOME/.config/prname/manifest if it exists, otherwise start
+   * with an empty one. A malformed line ends the loading, whatever
+   * was not loaded will just be treated as new.
+*/
+	char fn[PATH_MAX];
+	sprintf(fn, "%s/.config/%s/manifest", getenv("HOME"), prname);
+	manifest *mf = xmalloc(sizeof(manifest));
+	memset(mf, 0, sizeof(manifest));
+	mf->fn = xstrdup(fn);
+	mf->dirs = init_hash(1024);
+	pthread_mutex_init(&mf->lock, NULL);
+	mdata *md = mapfile(fn, 0);
+	if (!md) return mf;
+	size_t n = memlinestostr(md);
+	char *cp = md->fro;
+	mf_dir *cur = NULL;
+	size_t i;
+	for (i = 0; i < n; i++) {
+		char *next = cp + strlen(cp) + 1;
+		if (mf_readline(mf, cp, &cur, 0) == -1) {
+			fprintf(stderr, "Malformed line in %s: %s\n", fn, cp);
+			break;
+		}
+		cp = next;
+	}
+	mf_readline(mf, NULL, &cur, 0);
+	unmapfile(md);
+	return mf;
+} // load_manifest()
+
+int
+mf_readline(manifest *mf, char *line, mf_dir **cur, int seen)
+{ /* Add one line of the manifest format to mf. A 'D' line replaces any
+   * record of its dir, and is marked seen if seen is set, the lines
+   * after it add its members. Cur keeps the record being read, NULL to
+   * begin, and a NULL line ends it. Returns -1 if line is malformed.
+*/
+	if (!line || line[0] == 'D') {	// the last record is complete.
+		if (*cur) qsort((*cur)->kids, (*cur)->nkids, sizeof(mf_kid), kidcmp);
+		*cur = NULL;
+		if (!line) return 0;
+	}
+	char type = line[0];
+	mf_stat st;
+	long long extra;
+	char *name = parsestat(line + 1, &st, &extra);
+	if (!name) return -1;
+	if (type == 'D') {
+		mf_dir *md = xmalloc(sizeof(mf_dir));
+		memset(md, 0, sizeof(mf_dir));
+		md->st = st;
+		md->tmtime = extra;
+		md->seen = seen;
+		pthread_mutex_lock(&mf->lock);
+		mf_dir *old = hash_put(mf->dirs, name, md);
+		pthread_mutex_unlock(&mf->lock);
+		if (old) free_mfdir(old);
+		*cur = md;
+	} else if (*cur && (type == 'f' || type == 'd' || type == 'g')) {
+		mf_addkid(*cur, name, type, NULL, 0);
+		(*cur)->kids[(*cur)->nkids - 1].st = st;
+	}
+	return 0;
+} // mf_readline()
+
+void
+save_manifest(manifest *mf)
+{ /* Write the dirs seen this run to a temporary file and rename it
+   * over the manifest so that an interrupted save can't leave a
+   * truncated manifest behind. Records that have a '\n' in a name can't
+   * be written, the dir holding them will just be read every run.
+*/
+	char tmpfn[PATH_MAX];
+	sprintf(tmpfn, "%s.tmp", mf->fn);
+	FILE *fpo = dofopen(tmpfn, "w");
+	size_t iter = 0;
+	char *path;
+	void *val;
+	while (hash_next(mf->dirs, &iter, &path, &val)) {
+		mf_dir *md = val;
+		// Not visited this run, keep it only if the source dir has gone.
+		if (!md->seen && exists_dir(path)) continue;
+		mf_writedir(fpo, path, md);
+	}
+	dofclose(fpo);
+	if (rename(tmpfn, mf->fn) == -1) {
+		perror(mf->fn);
+		exit(EXIT_FAILURE);
+	}
+} // save_manifest()
+
+int
+mf_writedir(FILE *fpo, const char *path, mf_dir *md)
+{ /* Write the record md of the dir at path, as lines of the manifest.
+   * Returns -1, writing nothing, if a name has a '\n' in it.
+*/
+	if (strchr(path, '\n')) return -1;
+	size_t i;
+	for (i = 0; i < md->nkids; i++) {
+		if (strchr(md->kids[i].name, '\n')) return -1;
+	}
+	writestat(fpo, 'D', &md->st, md->tmtime, path);
+	for (i = 0; i < md->nkids; i++) {
+		writestat(fpo, md->kids[i].type, &md->kids[i].st, 0,
+					md->kids[i].name);
+	}
+	return 0;
+} // mf_writedir()
+
+void
+free_manifest(manifest *mf)
+{ /* free resources allocated by load_manifest() */
+	free_hash(mf->dirs, free_mfdir);
+	pthread_mutex_destroy(&mf->lock);
+	free(mf->fn);
+	free(mf);
+} // free_manifest()
+
+mf_dir
+*mf_getdir(manifest *mf, const char *path)
+{ /* Return the record of the source dir at path, NULL if none. Safe
+   * from any thread, so long as no two work on the same dir.
+*/
+	pthread_mutex_lock(&mf->lock);
+	mf_dir *md = hash_get(mf->dirs, path);
+	pthread_mutex_unlock(&mf->lock);
+	return md;
+} // mf_getdir()
+
+mf_dir
+*mf_newdir(struct stat *sb, struct stat *tsb)
+{ /* Make a new record for a dir from its stat and that of its target.
+   * It gets its members from mf_addkid() and is stored by mf_putdir().
+*/
+	mf_dir *md = xmalloc(sizeof(mf_dir));
+	memset(md, 0, sizeof(mf_dir));
+	mf_setstat(&md->st, sb, tsb->st_ino);
+	md->tmtime = mf_nsecs(&tsb->st_mtim);
+	return md;
+} // mf_newdir()
+
+void
+mf_putdir(manifest *mf, const char *path, mf_dir *md)
+{ /* Store the record md for the dir at path replacing any older one.
+   * Linked files of the old record that are not in md any more are kept
+   * in md as gone, 'g', so that reconcile() can find their targets.
+*/
+	qsort(md->kids, md->nkids, sizeof(mf_kid), kidcmp);
+	md->seen = 1;
+	pthread_mutex_lock(&mf->lock);
+	mf_dir *old = hash_put(mf->dirs, path, md);
+	pthread_mutex_unlock(&mf->lock);
+	if (old) keepgone(md, old);
+	if (mf->logdir) mf->logdir(mf->logarg, path, md);
+} // mf_putdir()
+
+void
+mf_keeptree(manifest *mf, const char *path)
+{ /* Mark the records of the dir at path, and of every dir under it, as
+   * seen, so that they are saved though the tree was not visited.
+*/
+	size_t len = strlen(path);
+	size_t iter = 0;
+	char *key;
+	void *val;
+	pthread_mutex_lock(&mf->lock);
+	while (hash_next(mf->dirs, &iter, &key, &val)) {
+		if (strncmp(key, path, len) == 0 && (!key[len] || key[len] == '/'))
+			((mf_dir *)val)->seen = 1;
+	}
+	pthread_mutex_unlock(&mf->lock);
+} // mf_keeptree()
+
+void
+mf_deldir(manifest *mf, const char *path)
+{ /* Forget the record of the dir at path. */
+	pthread_mutex_lock(&mf->lock);
+	mf_dir *md = hash_del(mf->dirs, path);
+	pthread_mutex_unlock(&mf->lock);
+	if (md) free_mfdir(md);
+} // mf_deldir()
+
+void
+mf_addkid(mf_dir *md, const char *name, char type, struct stat *sb,
+			ino_t tino)
+{ /* Add a member to the dir record md. If sb is NULL the member's
+   * stat fields are left zeroed.
+*/
+	if (md->nkids == md->size) {
+		md->size = (md->size) ? md->size * 2 : 16;
+		md->kids = realloc(md->kids, md->size * sizeof(mf_kid));
+		if (!md->kids) {
+			fputs("Out of memory.\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	mf_kid *kid = &md->kids[md->nkids++];
+	memset(kid, 0, sizeof(mf_kid));
+	kid->name = xstrdup((char *)name);
+	kid->type = type;
+	if (sb) mf_setstat(&kid->st, sb, tino);
+} // mf_addkid()
+
+mf_kid
+*mf_findkid(mf_dir *md, const char *name)
+{ /* Return the member of md called name, NULL if there is none. */
+	mf_kid key;
+	key.name = (char *)name;
+	return bsearch(&key, md->kids, md->nkids, sizeof(mf_kid), kidcmp);
+} // mf_findkid()
+
+void
+mf_dropkids(mf_dir *md, char type)
+{ /* Remove every member of md of the given type, order is kept. */
+	size_t i, n = 0;
+	for (i = 0; i < md->nkids; i++) {
+		if (md->kids[i].type == type) {
+			free(md->kids[i].name);
+		} else {
+			md->kids[n++] = md->kids[i];
+		}
+	}
+	md->nkids = n;
+} // mf_dropkids()
+
+int
+mf_samedir(mf_dir *md, struct stat *sb, struct stat *tsb)
+{ /* Return 1 if neither the source dir nor its target have changed
+   * since md was recorded, 0 otherwise.
+*/
+	return md->st.dev == sb->st_dev && md->st.ino == sb->st_ino
+		&& md->st.mtime == mf_nsecs(&sb->st_mtim)
+		&& md->st.tino == tsb->st_ino
+		&& md->tmtime == mf_nsecs(&tsb->st_mtim);
+} // mf_samedir()
+
+int
+mf_samefile(mf_kid *kid, struct stat *sb)
+{ /* Return 1 if the file is unchanged since kid was recorded and it
+   * was linked at that time, 0 otherwise.
+*/
+	return kid->type == 'f' && kid->st.tino
+		&& kid->st.dev == sb->st_dev && kid->st.ino == sb->st_ino
+		&& kid->st.mtime == mf_nsecs(&sb->st_mtim)
+		&& kid->st.size == sb->st_size;
+} // mf_samefile()
+
+void
+mf_setstat(mf_stat *st, struct stat *sb, ino_t tino)
+{ /* Copy the fields we keep from sb. */
+	st->dev = sb->st_dev;
+	st->ino = sb->st_ino;
+	st->mtime = mf_nsecs(&sb->st_mtim);
+	st->size = sb->st_size;
+	st->tino = tino;
+} // mf_setstat()
+
+long long
+mf_nsecs(struct timespec *ts)
+{ /* A timespec as nanoseconds. */
+	return (long long)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+} // mf_nsecs()
+
+static void
+free_mfdir(void *p)
+{ /* Free a dir record and its members. */
+	mf_dir *md = p;
+	size_t i;
+	for (i = 0; i < md->nkids; i++) free(md->kids[i].name);
+	free(md->kids);
+	free(md);
+} // free_mfdir()
+
+static void
+keepgone(mf_dir *md, mf_dir *old)
+{ /* For mf_putdir(), add the linked files of old that are not in md to
+   * md as gone, then free old.
+*/
+	size_t n = md->nkids;
+	size_t i;
+	for (i = 0; i < old->nkids; i++) {
+		mf_kid *kid = &old->kids[i];
+		if (kid->type == 'd' || !kid->st.tino) continue;
+		mf_kid key;
+		key.name = kid->name;
+		if (bsearch(&key, md->kids, n, sizeof(mf_kid), kidcmp)) continue;
+		mf_addkid(md, kid->name, 'g', NULL, 0);
+		md->kids[md->nkids - 1].st = kid->st;
+	}
+	if (md->nkids != n) qsort(md->kids, md->nkids, sizeof(mf_kid), kidcmp);
+	free_mfdir(old);
+} // keepgone()
+
+static int
+kidcmp(const void *a, const void *b)
+{ /* qsort() and bsearch() by name. */
+	return strcmp(((const mf_kid *)a)->name, ((const mf_kid *)b)->name);
+} // kidcmp()
+
+static char
+*parsestat(char *cp, mf_stat *st, long long *extra)
+{ /* Parse the 6 numbers following the type letter of a line, return
+   * a pointer to the name that follows them or NULL if malformed.
+*/
+	unsigned long long v[6];
+	int i;
+	for (i = 0; i < 6; i++) {
+		if (*cp != ' ') return NULL;
+		cp++;
+		char *ep;
+		errno = 0;
+		v[i] = strtoull(cp, &ep, 10);
+		if (ep == cp || errno) return NULL;
+		cp = ep;
+	}
+	if (*cp != ' ' || !cp[1]) return NULL;
+	st->dev = v[0];
+	st->ino = v[1];
+	st->mtime = v[2];
+	st->size = v[3];
+	st->tino = v[4];
+	*extra = v[5];
+	return cp + 1;
+} // parsestat()
+
+static void
+writestat(FILE *fpo, char type, mf_stat *st, long long extra,
+			const char *name)
+{ /* Write one line of the manifest. */
+	fprintf(fpo, "%c %llu %llu %lld %lld %llu %lld %s\n", type,
+			(unsigned long long)st->dev, (unsigned long long)st->ino,
+			st->mtime, (long long)st->size,
+			(unsigned long long)st->tino, extra, name);
+} // writestat()
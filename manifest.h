@@ -0,0 +1,142 @@
+/*    manifest.h
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of manifest.[h|c] is to remember, from one run to the
+ * next, what the source dirs held when they were last linked. A dir
+ * whose metadata, and that of its target, is unchanged need not be
+ * read again, only its sub-dirs need to be visited.
+ *
+ * The manifest is kept as $HOME/.config/csmanager/manifest with one
+ * line per record, the fields separated by a single space:
+ * D dev ino mtime size tino tmtime /path/of/source/dir
+ * f dev ino mtime size tino 0 name	(a file in the dir above)
+ * d dev ino 0 0 0 0 name			(a sub-dir of the dir above)
+ * g dev ino mtime size tino 0 name	(a file gone from the dir above)
+ * Times are in nanoseconds, tino and tmtime belong to the target.
+ *
+ * A file that was linked and has since gone from its source dir is
+ * kept as a 'g' record, and a dir that has gone keeps its record, so
+ * that reconcile() can tell which target files were ours. Both are
+ * dropped once reconcile() finds their targets gone.
+ * */
+
+#ifndef _MANIFEST_H
+#define _MANIFEST_H
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <errno.h>
+#include <pthread.h>
+#include "str.h"
+#include "files.h"
+#include "dirs.h"
+#include "hash.h"
+
+typedef struct mf_stat {
+	dev_t dev;
+	ino_t ino;
+	long long mtime;	// nanoseconds
+	off_t size;
+	ino_t tino;		// inode of the target.
+} mf_stat;
+
+typedef struct mf_kid {	// a member of a dir.
+	char *name;
+	char type;			// 'f' or 'd'.
+	mf_stat st;
+} mf_kid;
+
+typedef struct mf_dir {
+	mf_stat st;
+	long long tmtime;	// mtime of the target dir.
+	mf_kid *kids;		// sorted by name, 'f', 'd' or 'g'.
+	size_t nkids, size;
+	int seen;			// visited this run, kept when saved.
+} mf_dir;
+
+typedef struct manifest {
+	hash_t *dirs;		// mf_dir keyed by source path.
+	char *fn;			// where it's kept.
+	pthread_mutex_t lock;	// dirs may be got and put from any thread.
+	/* If set, called with logarg for every record mf_putdir() stores,
+	 * eg to journal it. */
+	void (*logdir)(void *logarg, const char *path, mf_dir *md);
+	void *logarg;
+} manifest;
+
+manifest
+*load_manifest(const char *prname);
+
+void
+save_manifest(manifest *mf);
+
+void
+free_manifest(manifest *mf);
+
+int
+mf_readline(manifest *mf, char *line, mf_dir **cur, int seen);
+
+int
+mf_writedir(FILE *fpo, const char *path, mf_dir *md);
+
+mf_dir
+*mf_getdir(manifest *mf, const char *path);
+
+mf_dir
+*mf_newdir(struct stat *sb, struct stat *tsb);
+
+void
+mf_putdir(manifest *mf, const char *path, mf_dir *md);
+
+void
+mf_deldir(manifest *mf, const char *path);
+
+void
+mf_keeptree(manifest *mf, const char *path);
+
+void
+mf_addkid(mf_dir *md, const char *name, char type, struct stat *sb,
+			ino_t tino);
+
+mf_kid
+*mf_findkid(mf_dir *md, const char *name);
+
+void
+mf_dropkids(mf_dir *md, char type);
+
+int
+mf_samedir(mf_dir *md, struct stat *sb, struct stat *tsb);
+
+int
+mf_samefile(mf_kid *kid, struct stat *sb);
+
+void
+mf_setstat(mf_stat *st, struct stat *sb, ino_t tino);
+
+long long
+mf_nsecs(struct timespec *ts);
+
+#endif
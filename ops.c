@@ -0,0 +1,450 @@
+/*    ops.c
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of ops.[h|c] is to hold the steps of a csmanager run.
+ * See ops.h.
+ * */
+
+#include "ops.h"
+
+static int
+istopdir(dr_data *dr, dr_ent *de, char *buf, size_t dlen, excl_t *excl);
+static void
+pipedir(pl_data *pl, const char *src, oper_t *ops, int dotsornot);
+static int
+journaled(const char *src, oper_t *ops);
+static void
+pipedone(void *arg, const char *path);
+static int
+isalive(pid_t pid);
+
+char
+**gen_dirslist(const char *dirname, int dotsornot, excl_t *excl)
+{/* get the dir names under dirname selecting or avoiding dot dirs,
+  * then turn the data into an array of C strings.
+*/
+	sarena *sa = init_sarena(0);
+	char buf[PATH_MAX];
+	strcpy(buf, dirname);
+	size_t dlen = strlen(buf);
+	dr_data dr;
+	if (dr_open(&dr, AT_FDCWD, dirname) == -1) {
+		perror(dirname);
+		exit(EXIT_FAILURE);
+	}
+	dr_ent ent, *de;
+	while ((de = dr_read(&dr, &ent))) {
+		if (dotsornot) {
+			if (de->name[0] != '.') continue;
+		} else {
+			if (de->name[0] == '.') continue;
+		}
+		if (istopdir(&dr, de, buf, dlen, excl)) sa_insert(sa, buf);
+	}
+	dr_close(&dr);
+	char **result = sa_toarray(sa);
+	free_sarena(sa);
+	return result;
+} // gen_dirslist()
+
+static int
+istopdir(dr_data *dr, dr_ent *de, char *buf, size_t dlen, excl_t *excl)
+{/* Return 1 if de, read from the source dir dr, is a dir to be synced,
+  * else 0. Buf holds the path of dr in its first dlen bytes, the path
+  * of de is put after it.
+*/
+	unsigned char type = de->type;
+	if (type == DT_UNKNOWN) {	// ask the file system.
+		struct stat sb;
+		if (fstatat(dr->fd, de->name, &sb, AT_SYMLINK_NOFOLLOW) == -1)
+			return 0;
+		type = IFTODT(sb.st_mode);
+	}
+	if (type != DT_DIR) return 0;
+	pathjoin(buf, dlen, de->name);
+	return !excluded(excl, buf);
+} // istopdir()
+
+excl_t
+*excl_list(const char *prname)
+{/* Return the compiled list of dirs to exclude from processing. If the
+  * excludes file does not exist, create it with some reasonable default
+  * values. A line ending in '/' excludes everything under that dir too.
+*/
+	char fpath[PATH_MAX] = {0};
+	char *home = getenv("HOME");
+	sprintf(fpath, "%s/.config/%s/excl.lst", home, prname);
+	if (!exists_file(fpath))
+	{	// create it
+		char *cp = strstr(fpath, "excl.lst");
+		*cp = 0;	// does the dir exist? If not create it.
+		mkdirp(fpath);
+		*cp = 'e';	// restore the filename to fpath.
+		FILE *fpo = dofopen(fpath, "w");
+		fprintf(fpo, "%s/%s\n", home, "Dropbox");
+		fprintf(fpo, "%s/%s\n", home, "Nextcloud");
+		dofclose(fpo);
+		sync();
+	}
+	char **lines = getfile_str(fpath);
+	excl_t *excl = init_excl(lines);
+	destroystrarray(lines, 0);
+	return excl;
+} // excl_list()
+
+char
+**getfromfile(oper_t *ops)
+{ /* Read the given file and generate the list of dirs from it. */
+	mdata *mydat = mapfile(ops->filname, 1);
+	size_t count = memlinestostr(mydat);
+	char **list = xmalloc((count+1) * sizeof(char *));
+	list[count] = (char *)NULL;
+	char *cp = mydat->fro;
+	size_t i;
+	for (i = 0; i < count; i++) {
+		if (cp[0] == '/') { // absolute path specified.
+			list[i] = xstrdup(cp);
+		} else {
+			char line[PATH_MAX];
+		/* dirs named in file must be relative to named source dir. */
+			strcpy(line, ops->dirname);
+			strjoin(line, '/', cp, PATH_MAX);
+			list[i] = xstrdup(line);
+		}
+		if (!exists_dir(list[i])) {
+			fprintf(stderr, "No such dir: %s\n", list[i]);
+			exit(EXIT_FAILURE);
+		}
+		cp += strlen(cp) + 1;
+	}
+	unmapfile(mydat);
+	return list;
+} // getfromfile()
+
+void
+processlist(char **synclist, oper_t *ops, int dotsornot)
+{ /* From the list of absolute paths in synclist, sync to the cloud
+   * targets. Each source tree is read once for all of them.
+*/
+	double start = st_now();
+	size_t i, k;
+	for (i = 0; synclist[i]; i++) {
+		char bufs[LK_MAXTARGETS][PATH_MAX];
+		char *dsts[LK_MAXTARGETS];
+		double t = st_now();
+		if (istarget(synclist[i], ops)) continue;	// never into itself.
+		if (journaled(synclist[i], ops)) continue;	// done before resuming.
+		if (ops->plan) {	// the plan makes no dirs.
+			for (k = 0; k < ops->ntargets; k++) {
+				mirrorpath(bufs[k], synclist[i], ops, dotsornot, k);
+				plantree(synclist[i], bufs[k], ops->linker);
+			}
+			st_dir(synclist[i], t);
+			continue;
+		}
+		/* For every $HOME/somedir, create $HOME/Nextcloud/somedir, and the
+		 * dot dirs dir above it for $HOME/.somedir, at most once a run. */
+		for (k = 0; k < ops->ntargets; k++) {
+			dsts[k] = bufs[k];
+			mirrorpath(bufs[k], synclist[i], ops, dotsornot, k);
+			mkdirp(bufs[k]);
+			if (!ops->quiet) printf("%s -> %s\n", synclist[i], bufs[k]);
+		}
+		st_phase("mkdir", t);
+		if (ops->jn) jn_begin(ops->jn, synclist[i]);
+		synctree(synclist[i], dsts, ops->linker);
+		if (ops->jn) jn_end(ops->jn, synclist[i]);
+		st_dir(synclist[i], t);
+	}
+	st_phase((ops->plan) ? "plantree" : "processlist", start);
+} // processlist()
+
+char
+**pipelist(oper_t *ops, excl_t *excl, int linkdots, char ***dotlist)
+{ /* As processlist() over the dirs that gen_dirslist() or getfromfile()
+   * would give, but each dir is handed to a pipeline of ops->nthreads
+   * link workers as soon as it is found. The source dir is read once
+   * for its visible and its dot dirs, the dot dirs are linked too if
+   * linkdots is set. Returns the visible dirs, or those listed, and
+   * puts the dot dirs in dotlist, NULL if working from a list.
+*/
+	double start = st_now();
+	unsigned urentries = (ops->linker->ur) ? ops->urentries : 0;
+	pl_data *pl = init_pipeline(ops->linker, ops->nthreads, ops->pipeline,
+								urentries, (ops->jn) ? pipedone : NULL, ops->jn);
+	char **synclist;
+	*dotlist = NULL;
+	if (ops->filname) {
+		synclist = getfromfile(ops);
+		size_t i, j;
+		for (i = 0; synclist[i]; i++) {
+			/* A dir listed twice, or under another listed, is linked
+			 * with that one. Two workers must never share a dir. */
+			for (j = 0; synclist[j]; j++) {
+				size_t len = strlen(synclist[j]);
+				if (j == i || strncmp(synclist[i], synclist[j], len))
+					continue;
+				if (synclist[i][len] == '/' || (!synclist[i][len] && j < i))
+					break;
+			}
+			if (!synclist[j]) pipedir(pl, synclist[i], ops, 0);
+		}
+	} else {
+		sarena *vis = init_sarena(0), *dots = init_sarena(0);
+		char buf[PATH_MAX];
+		strcpy(buf, ops->dirname);
+		size_t dlen = strlen(buf);
+		dr_data dr;
+		if (dr_open(&dr, AT_FDCWD, ops->dirname) == -1) {
+			perror(ops->dirname);
+			exit(EXIT_FAILURE);
+		}
+		dr_ent ent, *de;
+		while ((de = dr_read(&dr, &ent))) {
+			if (!istopdir(&dr, de, buf, dlen, excl)) continue;
+			if (de->name[0] == '.') {
+				sa_insert(dots, buf);
+				if (linkdots) pipedir(pl, buf, ops, 1);
+			} else {
+				sa_insert(vis, buf);
+				pipedir(pl, buf, ops, 0);
+			}
+		}
+		dr_close(&dr);
+		synclist = sa_toarray(vis);
+		*dotlist = sa_toarray(dots);
+		free_sarena(vis);
+		free_sarena(dots);
+	}
+	pl_finish(pl);
+	st_phase("pipelist", start);
+	return synclist;
+} // pipelist()
+
+static void
+pipedir(pl_data *pl, const char *src, oper_t *ops, int dotsornot)
+{ /* Make the target dirs of src, as processlist() does, and push it
+   * with them onto the pipeline.
+*/
+	if (istarget(src, ops)) return;	// never into itself.
+	if (journaled(src, ops)) return;
+	char dst[PATH_MAX];
+	int dfds[LK_MAXTARGETS];
+	size_t k;
+	for (k = 0; k < ops->ntargets; k++) {
+		mirrorpath(dst, src, ops, dotsornot, k);
+		mkdirp(dst);
+		if (!ops->quiet) printf("%s -> %s\n", src, dst);
+		dfds[k] = dopenat(AT_FDCWD, dst);
+	}
+	if (ops->jn) jn_begin(ops->jn, src);
+	pl_push(pl, dopenat(AT_FDCWD, src), dfds, src);
+} // pipedir()
+
+static void
+pipedone(void *arg, const char *path)
+{ /* The pipeline's finished(), the tree of path is linked. */
+	jn_end(arg, path);
+} // pipedone()
+
+static int
+journaled(const char *src, oper_t *ops)
+{ /* Return 1 if the run being resumed completed src. Its records in the
+   * manifest are kept as it won't be visited.
+*/
+	if (!ops->jn || !jn_isdone(ops->jn, src)) return 0;
+	mf_keeptree(ops->mf, src);
+	return 1;
+} // journaled()
+
+void
+resumerepair(oper_t *ops)
+{ /* Each dir begun but not completed by the run being resumed may have
+   * copies in its targets that were cut short when it was killed. Those
+   * are removed, unless the process that was making them is still
+   * alive. The dir is linked again so nothing else is needed.
+*/
+	char **inflight = ops->jn->inflight;
+	char dst[PATH_MAX];
+	size_t i, j, k;
+	for (i = 0; inflight[i]; i++) {
+		const char *base = strrchr(inflight[i], '/');
+		base = (base) ? base + 1 : inflight[i];
+		int dotsornot = !ops->filname && base[0] == '.';
+		for (k = 0; k < ops->ntargets; k++) {
+			mirrorpath(dst, inflight[i], ops, dotsornot, k);
+			if (!exists_dir(dst)) continue;	// never made.
+			rd_data *rd = init_recursedir(NULL, 1024, DT_REG, 0);
+			sarena *sa = init_sarena(rd->meminc);
+			recursedir(dst, sa, rd);
+			char **files = sa_toarray(sa);
+			for (j = 0; files[j]; j++) {
+				base = strrchr(files[j], '/') + 1;
+				pid_t pid = copytemp_pid(base);
+				if (!pid || pid == getpid() || isalive(pid)) continue;
+				if (unlink(files[j]) == -1) {
+					perror(files[j]);
+					exit(EXIT_FAILURE);
+				}
+				printf("Removed stale copy: %s\n", files[j]);
+			}
+			destroystrarray(files, 0);
+			free_recursedir(rd, sa);
+		}
+	}
+} // resumerepair()
+
+static int
+isalive(pid_t pid)
+{ /* Return 1 if the process pid may still be running. A zombie, eg
+   * a killed run not yet reaped, can no longer write anything.
+*/
+	if (kill(pid, 0) == -1 && errno == ESRCH) return 0;
+	char fn[64], state = 0;
+	sprintf(fn, "/proc/%d/stat", (int)pid);
+	FILE *fp = fopen(fn, "r");
+	if (!fp) return 1;	// can't tell.
+	if (fscanf(fp, "%*d (%*[^)]) %c", &state) != 1) state = 0;
+	fclose(fp);
+	return state != 'Z';
+} // isalive()
+
+void
+tardotdirs(char **dotlist, oper_t *ops, excl_t *excl)
+{ /* Instead of linking them, put each dot dir in dotlist into its own
+   * compressed tarball in the dot dirs dir of each target, $HOME/.config
+   * going to config.tgz. It is written once, the other targets get a
+   * link to it, or a copy. Only dirs with something changed since
+   * $HOME/dottim was last set, or with no tarball yet, are written.
+   * Dottim is then set to the start of this run, so nothing changed
+   * meanwhile is missed.
+*/
+	double start = st_now();
+	char dottim[PATH_MAX];
+	strcpy(dottim, ops->dirname);
+	strjoin(dottim, '/', "dottim", PATH_MAX);
+	struct stat sb;
+	long long since = 0;	// no dottim, everything is new.
+	if (stat(dottim, &sb) == 0) {
+		since = sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+	}
+	struct timespec now[2];
+	clock_gettime(CLOCK_REALTIME, &now[0]);
+	now[1] = now[0];
+	size_t k;
+	if (!ops->plan) {
+		for (k = 0; k < ops->ntargets; k++) mkdirp(ops->dotdirs_dirs[k]);
+	}
+	char base[PATH_MAX];
+	strcpy(base, ops->dirname);
+	base[ops->len2target] = 0;	// the parent of the dot dirs.
+	size_t i, ntars = 0, nsame = 0;
+	long long nbytes = 0;
+	for (i = 0; dotlist[i]; i++) {
+		double t = st_now();
+		char dsts[LK_MAXTARGETS][PATH_MAX], tmp[PATH_MAX];
+		int have = 1;
+		for (k = 0; k < ops->ntargets; k++) {
+			strcpy(dsts[k], ops->dotdirs_dirs[k]);
+			strjoin(dsts[k], '/', dotlist[i] + ops->len2target + 2,
+					PATH_MAX);
+			strjoin(dsts[k], 0, ".tgz", PATH_MAX);
+			if (!exists_file(dsts[k])) have = 0;
+		}
+		tar_list *tl = tar_scan(base, dotlist[i], excl);
+		if (tl->newest <= since && have) {
+			nsame++;
+			free_tarlist(tl);
+			continue;
+		}
+		ntars++;
+		for (k = 0; k < ops->ntargets; k++) {
+			nbytes += tl->bytes;
+			if (ops->plan) {
+				printf("tar\t%lld\t%s\t%s\n", tl->bytes, dotlist[i],
+						dsts[k]);
+				continue;
+			}
+			if (!ops->quiet) printf("%s -> %s\n", dotlist[i], dsts[k]);
+			strcpy(tmp, dsts[k]);
+			strjoin(tmp, 0, ".tmp", PATH_MAX);
+			unlink(tmp);	// left by a failed run.
+			if (k == 0) {
+				pid_t pid;
+				FILE *fp = tar_compressor(tmp, &pid);
+				tar_write(fp, tl, base);
+				tar_endcompressor(fp, pid, tmp);
+			} else if (link(dsts[0], tmp) == -1) {	// eg another fs.
+				copyfile(dsts[0], tmp);
+			}
+			if (rename(tmp, dsts[k]) == -1) {
+				perror(dsts[k]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		free_tarlist(tl);
+		st_dir(dotlist[i], t);
+	}
+	if (ops->plan) {
+		printf("tarballs\t%lu\tunchanged=%lu\tbytes=%lld\n", ntars, nsame,
+				nbytes);
+	} else {
+		touch(dottim);
+		if (utimensat(AT_FDCWD, dottim, now, 0) == -1) {
+			perror(dottim);
+			exit(EXIT_FAILURE);
+		}
+		printf("Dot dirs tarballed: %lu, unchanged: %lu\n", ntars, nsame);
+	}
+	st_phase("tardotdirs", start);
+} // tardotdirs()
+
+void
+mirrorpath(char *buf, const char *src, oper_t *ops, int dotsornot,
+			size_t k)
+{ /* Put the target k of the source dir src into buf, a buffer of
+   * PATH_MAX. Eg $HOME/somedir goes to $HOME/Nextcloud/somedir and
+   * $HOME/.somedir to $HOME/Nextcloud/Dotty/.somedir
+*/
+	strcpy(buf, (dotsornot) ? ops->dotdirs_dirs[k] : ops->cloud_targets[k]);
+	strjoin(buf, '/', (char *)src + ops->len2target + 1, PATH_MAX);
+} // mirrorpath()
+
+int
+istarget(const char *path, oper_t *ops)
+{ /* Return 1 if path is one of the cloud targets, 0 otherwise. */
+	size_t k;
+	for (k = 0; k < ops->ntargets; k++) {
+		if (strcmp(path, ops->cloud_targets[k]) == 0) return 1;
+	}
+	return 0;
+} // istarget()
+
+char
+*build_path(char *s1, char *s2, char *s3)
+{ /* Assemble a path of names separated by '/', s3 may be NULL. */
+	char buf[PATH_MAX];
+	strcpy(buf, s1);
+	strjoin(buf, '/', s2, PATH_MAX);
+	if (s3) {
+		strjoin(buf, '/', s3, PATH_MAX);
+	}
+	return xstrdup(buf);
+} // build_path()
@@ -0,0 +1,104 @@
+/*    ops.h
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of ops.[h|c] is to hold the steps of a csmanager run,
+ * finding the dirs to sync and syncing them, apart from main() so that
+ * csbench can time them.
+ * */
+
+#ifndef _OPS_H
+#define _OPS_H
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <errno.h>
+#include <signal.h>
+#include "str.h"
+#include "dirs.h"
+#include "files.h"
+#include "excl.h"
+#include "linker.h"
+#include "manifest.h"
+#include "tar.h"
+#include "cfg.h"
+#include "pipeline.h"
+#include "journal.h"
+
+typedef struct oper_t {
+	char *dirname;		// source dir to be synced.
+	char *filname;		// file listing source dirs to sync.
+	char *cloud_targets[LK_MAXTARGETS + 1];	// eg Dropbox and Nextcloud.
+	char *dotdirs_dirs[LK_MAXTARGETS + 1];	// for dot dirs, one per target.
+	size_t ntargets;	// each dir is synced to every target.
+	char **excludes;	// list of dirs to exclude eg $HOME/Dropbox etc.
+	int do_master_dir;	// a dir, not a file listing dirs.
+	size_t len2target;	// byte count to (for example) $HOME/Nextcloud
+	struct lk_data *linker;	// hard link engine and its counts.
+	struct manifest *mf;	// what was linked on the last run.
+	int watch;			// keep running, linking changes as they happen.
+	int nthreads;		// threads to read source trees with.
+	int plan;			// change nothing, print what would be done.
+	int quiet;			// don't list the dirs as they are synced.
+	struct cfg_t *cfg;	// settings from the config file.
+	int fixthreads;		// nthreads was given by -j, ignore the config.
+	size_t pipeline;	// queue depth for pipelist(), 0 if not used.
+	unsigned urentries;	// ring size, for each pipeline worker.
+	struct jn_t *jn;	// journal of the run, NULL if not kept.
+} oper_t;
+
+char
+**gen_dirslist(const char *dirname, int dotsornot, excl_t *excl);
+
+excl_t
+*excl_list(const char *prname);
+
+char
+**getfromfile(oper_t *ops);
+
+void
+processlist(char **synclist, oper_t *ops, int dotsornot);
+
+char
+**pipelist(oper_t *ops, excl_t *excl, int linkdots, char ***dotlist);
+
+void
+resumerepair(oper_t *ops);
+
+void
+tardotdirs(char **dotlist, oper_t *ops, excl_t *excl);
+
+void
+mirrorpath(char *buf, const char *src, oper_t *ops, int dotsornot,
+			size_t k);
+
+int
+istarget(const char *path, oper_t *ops);
+
+char
+*build_path(char *s1, char *s2, char *s3);
+
+#endif
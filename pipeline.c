@@ -0,0 +1,322 @@
+/*    pipeline.c
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of pipeline.[h|c] is to link trees while the dirs to be
+ * linked are still being found. See pipeline.h.
+ * */
+
+#include "pipeline.h"
+
+static int
+pl_trypush(pl_queue *q, pl_item *item);
+static int
+pl_pop(pl_queue *q, pl_item *item);
+static int
+pl_take(pl_data *pl, pl_item *item);
+static int
+pl_over(pl_data *pl);
+static unsigned
+pl_prepare(pl_event *ev);
+static void
+pl_wait(pl_event *ev, unsigned key);
+static void
+pl_cancel(pl_event *ev);
+static void
+pl_wake(pl_event *ev, int n);
+static int
+pl_spawn(void *arg, int sfd, int *dfds, const char *path);
+static void
+*pl_work(void *arg);
+
+pl_data
+*init_pipeline(lk_data *lk, int nworkers, size_t depth,
+				unsigned urentries,
+				void (*finished)(void *arg, const char *path), void *arg)
+{ /* Start nworkers threads linking, each with a linker cloned from lk
+   * and a ring of urentries if that is not 0. The queue holds depth
+   * dirs, rounded down to a power of 2, but no more than would use half
+   * the fds we may open, and at least 2. Finished, if not NULL, is
+   * called with arg and the path of each pushed dir once its tree is
+   * linked.
+*/
+	struct rlimit rl;
+	size_t perdir = 1 + lk->ntargets;	// fds held by a queued dir.
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY
+		&& depth > rl.rlim_cur / 2 / perdir) {
+		depth = rl.rlim_cur / 2 / perdir;
+	}
+	size_t size = 2;
+	while (size * 2 <= depth) size *= 2;
+	pl_data *pl = xmalloc(sizeof(pl_data));
+	memset(pl, 0, sizeof(pl_data));
+	pl->start = st_now();
+	pl->lk = lk;
+	pl->q.slots = xmalloc(size * sizeof(pl_slot));
+	pl->q.mask = size - 1;
+	size_t i;
+	for (i = 0; i < size; i++) pl->q.slots[i].seq = i;
+	pl->finished = finished;
+	pl->arg = arg;
+	pl->nworkers = (nworkers > 0) ? nworkers : 1;
+	pl->workers = xmalloc(pl->nworkers * sizeof(pl_worker));
+	memset(pl->workers, 0, pl->nworkers * sizeof(pl_worker));
+	int w;
+	for (w = 0; w < pl->nworkers; w++) {
+		pl_worker *wk = &pl->workers[w];
+		wk->pl = pl;
+		wk->lk = clone_linker(lk);
+		wk->lk->spawn = pl_spawn;
+		wk->lk->pl = wk;
+		if (urentries) wk->lk->ur = init_uring(urentries);
+	}
+	for (w = 0; w < pl->nworkers; w++) {
+		pl_worker *wk = &pl->workers[w];
+		int res = pthread_create(&wk->tid, NULL, pl_work, wk);
+		if (res) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(res));
+			exit(EXIT_FAILURE);
+		}
+	}
+	return pl;
+} // init_pipeline()
+
+void
+pl_push(pl_data *pl, int sfd, int *dfds, const char *path)
+{ /* Queue the source dir open on sfd, named path, to be linked into
+   * the targets open on dfds, one per target. The fds then belong to
+   * the pipeline. Waits while the queue is full.
+*/
+	pl_item item;
+	item.sfd = sfd;
+	memcpy(item.dfds, dfds, pl->lk->ntargets * sizeof(int));
+	item.path = xstrdup((char *)path);
+	item.root = xmalloc(sizeof(pl_root));
+	item.root->path = xstrdup((char *)path);
+	item.root->pending = 1;
+	__atomic_add_fetch(&pl->pending, 1, __ATOMIC_ACQ_REL);
+	unsigned key = 0;
+	int spins = 0, waiting = 0;
+	while (pl_trypush(&pl->q, &item) == -1) {
+		if (waiting) {
+			pl_wait(&pl->q.room, key);
+			waiting = 0;
+		} else if (++spins < PL_SPINS) {
+			sched_yield();
+		} else {	// try once more after saying we'll wait.
+			key = pl_prepare(&pl->q.room);
+			waiting = 1;
+		}
+	}
+	if (waiting) pl_cancel(&pl->q.room);
+} // pl_push()
+
+void
+pl_finish(pl_data *pl)
+{ /* No more dirs will be pushed. Wait until the workers have linked
+   * all that were, add their counts to the linker given to
+   * init_pipeline() and free the pipeline.
+*/
+	__atomic_store_n(&pl->done, 1, __ATOMIC_SEQ_CST);
+	pl_wake(&pl->q.more, INT_MAX);
+	int w;
+	for (w = 0; w < pl->nworkers; w++)
+		pthread_join(pl->workers[w].tid, NULL);
+	for (w = 0; w < pl->nworkers; w++)
+		merge_linker(pl->lk, pl->workers[w].lk);
+	free(pl->workers);
+	free(pl->q.slots);
+	free(pl);
+} // pl_finish()
+
+static int
+pl_trypush(pl_queue *q, pl_item *item)
+{ /* Put item at the tail of q, returns -1 if q is full, else 0. */
+	size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	pl_slot *slot;
+	while (1) {
+		slot = &q->slots[pos & q->mask];
+		size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		long diff = (long)seq - (long)pos;
+		if (diff == 0) {	// free for this turn, claim it.
+			if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+		} else if (diff < 0) {	// not yet popped last time round.
+			return -1;
+		} else {	// another thread took it, try the new tail.
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+		}
+	}
+	slot->item = *item;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	pl_wake(&q->more, 1);
+	return 0;
+} // pl_trypush()
+
+static int
+pl_pop(pl_queue *q, pl_item *item)
+{ /* Take the item at the head of q into item, returns 0 if q is empty,
+   * else 1.
+*/
+	size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	pl_slot *slot;
+	while (1) {
+		slot = &q->slots[pos & q->mask];
+		size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		long diff = (long)seq - (long)(pos + 1);
+		if (diff == 0) {	// full for this turn, claim it.
+			if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+		} else if (diff < 0) {	// not yet pushed.
+			return 0;
+		} else {
+			pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+		}
+	}
+	*item = slot->item;
+	__atomic_store_n(&slot->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+	pl_wake(&q->room, 1);
+	return 1;
+} // pl_pop()
+
+static int
+pl_take(pl_data *pl, pl_item *item)
+{ /* Pop the next dir into item for a worker, waiting if there is none
+   * yet. Returns 1 with a dir, 0 when there will be no more.
+*/
+	unsigned key = 0;
+	int spins = 0, waiting = 0, ret;
+	while (1) {
+		if (pl_pop(&pl->q, item)) {
+			ret = 1;
+			break;
+		}
+		if (pl_over(pl)) {
+			ret = 0;
+			break;
+		}
+		if (waiting) {
+			pl_wait(&pl->q.more, key);
+			waiting = 0;
+		} else if (++spins < PL_SPINS) {
+			sched_yield();
+		} else {	// look once more after saying we'll wait.
+			key = pl_prepare(&pl->q.more);
+			waiting = 1;
+		}
+	}
+	if (waiting) pl_cancel(&pl->q.more);
+	return ret;
+} // pl_take()
+
+static int
+pl_over(pl_data *pl)
+{ /* Returns 1 if the finder is done and every dir is linked. */
+	return __atomic_load_n(&pl->done, __ATOMIC_SEQ_CST) &&
+			__atomic_load_n(&pl->pending, __ATOMIC_SEQ_CST) == 0;
+} // pl_over()
+
+/* An eventcount: a thread that would wait for something calls
+ * pl_prepare(), looks once more and then either pl_cancel()s or
+ * pl_wait()s with the key it was given. A thread that has made the
+ * something happen calls pl_wake(), which bumps seq so a pl_wait() that
+ * has yet to sleep won't, and makes the futex call only if a thread is
+ * waiting. The sequentially consistent order of waiters and seq is what
+ * stops a wakeup being lost between the look and the sleep.
+ * */
+
+static unsigned
+pl_prepare(pl_event *ev)
+{ /* Say we are about to wait on ev, returns the key for pl_wait(). */
+	__atomic_add_fetch(&ev->waiters, 1, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&ev->seq, __ATOMIC_SEQ_CST);
+} // pl_prepare()
+
+static void
+pl_wait(pl_event *ev, unsigned key)
+{ /* Sleep until ev has been woken since key was got. */
+	syscall(SYS_futex, &ev->seq, FUTEX_WAIT_PRIVATE, key, NULL, NULL, 0);
+	__atomic_sub_fetch(&ev->waiters, 1, __ATOMIC_SEQ_CST);
+} // pl_wait()
+
+static void
+pl_cancel(pl_event *ev)
+{ /* We said we'd wait on ev but needn't now. */
+	__atomic_sub_fetch(&ev->waiters, 1, __ATOMIC_SEQ_CST);
+} // pl_cancel()
+
+static void
+pl_wake(pl_event *ev, int n)
+{ /* Wake up to n threads waiting on ev. */
+	__atomic_add_fetch(&ev->seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ev->waiters, __ATOMIC_SEQ_CST))
+		syscall(SYS_futex, &ev->seq, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+} // pl_wake()
+
+static int
+pl_spawn(void *arg, int sfd, int *dfds, const char *path)
+{ /* The linker's spawn(), queue a sub-dir if there is room. Returns 0
+   * if it was queued, -1 if the worker must link it itself.
+*/
+	pl_worker *wk = arg;
+	pl_data *pl = wk->pl;
+	pl_item item;
+	item.sfd = sfd;
+	memcpy(item.dfds, dfds, pl->lk->ntargets * sizeof(int));
+	item.path = xstrdup((char *)path);
+	item.root = wk->root;
+	// Counted before it can be popped, so pending can't reach 0 early.
+	__atomic_add_fetch(&item.root->pending, 1, __ATOMIC_ACQ_REL);
+	__atomic_add_fetch(&pl->pending, 1, __ATOMIC_ACQ_REL);
+	if (pl_trypush(&pl->q, &item) == 0) return 0;
+	__atomic_sub_fetch(&pl->pending, 1, __ATOMIC_ACQ_REL);
+	__atomic_sub_fetch(&item.root->pending, 1, __ATOMIC_ACQ_REL);
+	free(item.path);
+	return -1;
+} // pl_spawn()
+
+static void
+*pl_work(void *arg)
+{ /* Thread function, link dirs from the queue until it is empty and no
+   * dir is still being linked, once the finder is done.
+*/
+	pl_worker *wk = arg;
+	pl_data *pl = wk->pl;
+	char path[PATH_MAX];
+	pl_item item;
+	while (pl_take(pl, &item)) {
+		if (!__atomic_exchange_n(&pl->started, 1, __ATOMIC_ACQ_REL))
+			st_phase("first_dir", pl->start);
+		strcpy(path, item.path);
+		free(item.path);
+		wk->root = item.root;
+		synctreeat(item.sfd, item.dfds, path, wk->lk);
+		if (__atomic_sub_fetch(&item.root->pending, 1, __ATOMIC_ACQ_REL)
+			== 0) {	// the last of its tree.
+			if (pl->finished) pl->finished(pl->arg, item.root->path);
+			free(item.root->path);
+			free(item.root);
+		}
+		if (__atomic_sub_fetch(&pl->pending, 1, __ATOMIC_SEQ_CST) == 0
+			&& __atomic_load_n(&pl->done, __ATOMIC_SEQ_CST)) {
+			pl_wake(&pl->q.more, INT_MAX);	// all linked, let all go.
+		}
+	}
+	return NULL;
+} // pl_work()
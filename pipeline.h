@@ -0,0 +1,128 @@
+/*    pipeline.h
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of pipeline.[h|c] is to link trees while the dirs to be
+ * linked are still being found. The finder pushes each dir, open with
+ * its targets, onto a bounded queue and link workers take them off as
+ * they come, so the first links are made as soon as the first dir is
+ * found. A worker also pushes the sub-dirs it finds while the queue has
+ * room, and links them itself when it hasn't, so one big tree is shared
+ * among the workers too, and the dirs waiting, and their fds, never
+ * exceed the queue depth.
+ *
+ * The queue is a ring of slots each with a sequence number, which says
+ * whether the slot is free for the push of a given turn or full for the
+ * pop of that turn. Head and tail are claimed by compare and swap, so
+ * any number of threads may push and pop without a lock. A thread that
+ * finds the queue empty, or full, yields a few times and then sleeps
+ * on an eventcount, a futex word bumped by every push, or pop, that
+ * may have a sleeper to wake.
+ * */
+
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <linux/futex.h>
+#include "str.h"
+#include "dirs.h"
+#include "linker.h"
+#include "uring.h"
+#include "stats.h"
+
+#define PL_SPINS 16	// yields before a thread sleeps on the queue.
+
+typedef struct pl_root {	// a dir pushed by pl_push().
+	char *path;
+	size_t pending;		// dirs of its tree queued or being linked.
+} pl_root;
+
+typedef struct pl_item {	// a dir to be linked, and its targets.
+	int sfd;
+	int dfds[LK_MAXTARGETS];
+	char *path;
+	pl_root *root;		// the pushed dir it is in the tree of.
+} pl_item;
+
+typedef struct pl_slot {
+	size_t seq;			// turn this slot is ready for.
+	pl_item item;
+} pl_slot;
+
+typedef struct pl_event {	// threads asleep until something changes.
+	unsigned seq;		// the futex word, bumped by pl_wake().
+	unsigned waiters;	// threads between pl_prepare() and waking.
+} pl_event;
+
+typedef struct pl_queue {
+	pl_slot *slots;
+	size_t mask;		// slots - 1, a power of 2.
+	size_t head __attribute__((aligned(64)));	// next to pop.
+	size_t tail __attribute__((aligned(64)));	// next to push.
+	pl_event more __attribute__((aligned(64)));	// pushed, or finished.
+	pl_event room;		// popped.
+} pl_queue;
+
+struct pl_data;
+
+typedef struct pl_worker {
+	struct pl_data *pl;
+	lk_data *lk;		// its own linker.
+	pl_root *root;		// of the dir being linked.
+	pthread_t tid;
+} pl_worker;
+
+typedef struct pl_data {
+	pl_queue q;
+	lk_data *lk;		// the counts of every worker end up here.
+	pl_worker *workers;
+	int nworkers;
+	/* Called, if set, from a worker when the whole tree of a pushed
+	 * dir is linked. */
+	void (*finished)(void *arg, const char *path);
+	void *arg;
+	size_t pending;		// dirs pushed and not yet linked.
+	int done;			// nothing more will be pushed but by workers.
+	int started;		// a worker has taken its first dir.
+	double start;
+} pl_data;
+
+pl_data
+*init_pipeline(lk_data *lk, int nworkers, size_t depth,
+				unsigned urentries,
+				void (*finished)(void *arg, const char *path), void *arg);
+
+void
+pl_push(pl_data *pl, int sfd, int *dfds, const char *path);
+
+void
+pl_finish(pl_data *pl);
+
+#endif
@@ -0,0 +1,329 @@
+/*    reconcile.c
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of reconcile.[h|c] is to remove target files whose source
+ * has gone. See reconcile.h.
+ * */
+
+#include "reconcile.h"
+
+static void
+addent(rc_ent **ents, size_t *n, size_t *size, ino_t tino, mf_dir *md,
+			mf_kid *kid, char *path);
+static int
+entcmp(const void *a, const void *b);
+static int
+dircmp(const void *a, const void *b);
+static rc_ent
+*findent(rc_ent *ents, size_t n, ino_t tino, const char *name);
+static rc_ent
+*finddir(rc_data *rc, const char *path);
+static size_t
+rcdir(rc_data *rc, int pfd, const char *name, char *dpath, char *spath,
+			const char *skip);
+static int
+rcfile(rc_data *rc, int dfd, dr_ent *de, char *dpath, char *spath);
+static int
+gone(const char *path);
+
+rc_data
+*init_reconcile(manifest *mf, int dryrun)
+{ /* Make the tables of the target files and dirs that mf knows of. */
+	rc_data *rc = xmalloc(sizeof(rc_data));
+	memset(rc, 0, sizeof(rc_data));
+	rc->mf = mf;
+	rc->dryrun = dryrun;
+	size_t fsize = 0, dsize = 0;
+	size_t iter = 0;
+	char *path;
+	void *val;
+	while (hash_next(mf->dirs, &iter, &path, &val)) {
+		mf_dir *md = val;
+		addent(&rc->dirs, &rc->ndirs, &dsize, md->st.tino, md, NULL, path);
+		size_t i;
+		for (i = 0; i < md->nkids; i++) {
+			mf_kid *kid = &md->kids[i];
+			if (kid->type == 'd' || !kid->st.tino) continue;
+			addent(&rc->files, &rc->nfiles, &fsize, kid->st.tino, md, kid,
+					path);
+		}
+	}
+	qsort(rc->files, rc->nfiles, sizeof(rc_ent), entcmp);
+	qsort(rc->dirs, rc->ndirs, sizeof(rc_ent), dircmp);
+	rc->copies = init_hash(rc->nfiles);
+	char buf[PATH_MAX];
+	size_t i;
+	for (i = 0; i < rc->nfiles; i++) {
+		rc_ent *e = &rc->files[i];
+		strcpy(buf, e->path);
+		pathjoin(buf, strlen(buf), e->kid->name);
+		hash_put(rc->copies, buf, e);
+	}
+	return rc;
+} // init_reconcile()
+
+void
+free_reconcile(rc_data *rc)
+{ /* free resources allocated by init_reconcile() */
+	free(rc->files);
+	free_hash(rc->copies, NULL);
+	free(rc->dirs);
+	free(rc);
+} // free_reconcile()
+
+void
+reconcile(rc_data *rc, size_t k, const char *srcdir, const char *dstdir,
+			const char *skip)
+{ /* Remove the orphans under dstdir, the target of srcdir in cloud
+   * target k. The dir skip, if not NULL, is not entered, eg the dot dirs
+   * dir in the cloud dir which has a walk of its own. Dstdir itself is
+   * never removed. Every target is walked with the one rc before
+   * rc_prune(), so that a record is kept while any target has it.
+*/
+	rc->bit = 1u << k;
+	if (!exists_dir(dstdir)) return;
+	// The target may be a symlink to a dir, eg on another disk.
+	int dfd = open(dstdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd == -1) {
+		perror(dstdir);
+		exit(EXIT_FAILURE);
+	}
+	char dpath[PATH_MAX], spath[PATH_MAX];
+	strcpy(dpath, dstdir);
+	strcpy(spath, srcdir);
+	rcdir(rc, dfd, ".", dpath, spath, skip);
+	close(dfd);
+} // reconcile()
+
+void
+rc_prune(rc_data *rc)
+{ /* Drop from the manifest the gone files whose targets are gone now,
+   * from every target walked, and the records of gone dirs whose
+   * targets are gone. Other files whose targets are gone are marked as
+   * not linked. Not for a dry run.
+*/
+	size_t i;
+	for (i = 0; i < rc->nfiles; i++) {
+		rc_ent *e = &rc->files[i];
+		if (e->found) continue;
+		if (e->kid->type == 'g') {
+			e->kid->type = 0;
+		} else {
+			e->kid->st.tino = 0;
+		}
+	}
+	size_t iter = 0;
+	char *path;
+	void *val;
+	while (hash_next(rc->mf->dirs, &iter, &path, &val)) {
+		mf_dropkids(val, 0);
+	}
+	char **dead = xmalloc((rc->ndirs + 1) * sizeof(char *));
+	size_t ndead = 0;
+	for (i = 0; i < rc->ndirs; i++) {
+		rc_ent *e = &rc->dirs[i];
+		if (!e->found && !e->md->seen && gone(e->path))
+			dead[ndead++] = xstrdup(e->path);
+	}
+	for (i = 0; i < ndead; i++) {
+		mf_deldir(rc->mf, dead[i]);
+		free(dead[i]);
+	}
+	free(dead);
+	// the tables point into the manifest, they are no use now.
+	rc->nfiles = rc->ndirs = 0;
+	free_hash(rc->copies, NULL);
+	rc->copies = init_hash(0);
+} // rc_prune()
+
+void
+reconcile_report(rc_data *rc)
+{ /* Summary of the orphans removed, or to be removed. */
+	if (rc->dryrun) {	// same format as the plan.
+		printf("reconcile\tremoves=%lu\trmdirs=%lu\tbytes=%lld\n",
+				rc->nremoved, rc->npruned, rc->nbytes);
+		return;
+	}
+	printf("Orphans removed: %lu, bytes: %lld, empty dirs removed: %lu\n",
+			rc->nremoved, rc->nbytes, rc->npruned);
+} // reconcile_report()
+
+static size_t
+rcdir(rc_data *rc, int pfd, const char *name, char *dpath, char *spath,
+			const char *skip)
+{ /* Reconcile the dir name in pfd whose path is dpath, the target of
+   * spath. Both paths are extended and restored in place. Returns the
+   * number of entries left in the dir, or that would be left if this is
+   * a dry run.
+*/
+	dr_data dr;
+	if (dr_open(&dr, pfd, name) == -1) {
+		perror(dpath);
+		exit(EXIT_FAILURE);
+	}
+	size_t dlen = strlen(dpath), slen = strlen(spath);
+	size_t left = 0;
+	dr_ent ent, *de;
+	while ((de = dr_read(&dr, &ent))) {
+		unsigned char type = de->type;
+		if (type == DT_UNKNOWN) {
+			struct stat sb;
+			st_add(ST_STAT, 1);
+			if (fstatat(dr.fd, de->name, &sb, AT_SYMLINK_NOFOLLOW) == -1)
+				continue;	// gone since it was read.
+			type = IFTODT(sb.st_mode);
+		}
+		pathjoin(dpath, dlen, de->name);
+		pathjoin(spath, slen, de->name);
+		if (type == DT_REG) {
+			if (!rcfile(rc, dr.fd, de, dpath, spath)) left++;
+		} else if (type == DT_DIR && !(skip && strcmp(dpath, skip) == 0)) {
+			size_t n = rcdir(rc, dr.fd, de->name, dpath, spath, skip);
+			rc_ent *e = finddir(rc, spath);
+			if (n || !e || !gone(spath)) {
+				left++;
+				if (e) e->found |= rc->bit;
+			} else if (rc->dryrun) {
+				printf("rmdir\t%s\n", dpath);
+				rc->npruned++;
+			} else if (unlinkat(dr.fd, de->name, AT_REMOVEDIR) == -1) {
+				perror(dpath);
+				left++;
+				e->found |= rc->bit;
+			} else {
+				mkdirp_forget(dpath);
+				printf("Removed: %s\n", dpath);
+				rc->npruned++;
+			}
+		} else {
+			left++;
+		}
+	}
+	dpath[dlen] = 0;
+	spath[slen] = 0;
+	dr_close(&dr);
+	return left;
+} // rcdir()
+
+static int
+rcfile(rc_data *rc, int dfd, dr_ent *de, char *dpath, char *spath)
+{ /* Remove the file de in dfd, at dpath, if it is an orphan. Spath is
+   * where its source would be. Returns 1 if it was, or would be,
+   * removed.
+*/
+	rc_ent *e = findent(rc->files, rc->nfiles, de->ino, de->name);
+	int bypath = !e;
+	if (bypath) e = hash_get(rc->copies, spath);	// a copy, maybe.
+	if (!e) return 0;	// not ours.
+	struct stat sb;
+	st_add(ST_STAT, 1);
+	if (fstatat(dfd, de->name, &sb, AT_SYMLINK_NOFOLLOW) == -1) return 0;
+	// Found by path, it's ours only if it can't be a link.
+	if (bypath && sb.st_dev == e->kid->st.dev) return 0;
+	/* The inode may have been freed and used again, so the file must
+	 * also be as recorded. */
+	e->found |= rc->bit;
+	if (sb.st_size != e->kid->st.size ||
+		mf_nsecs(&sb.st_mtim) != e->kid->st.mtime) return 0;
+	/* With other links and a record of a file that was there at the last
+	 * visit to its dir, the source can't have gone. */
+	if (sb.st_nlink > 1 && e->kid->type == 'f' && e->md->seen) return 0;
+	if (!gone(spath)) return 0;
+	if (rc->dryrun) {
+		printf("remove\t%lld\t%s\n", (long long)sb.st_size, dpath);
+	} else if (unlinkat(dfd, de->name, 0) == -1) {
+		perror(dpath);
+		return 0;
+	} else {
+		printf("Removed: %s\n", dpath);
+	}
+	e->found &= ~rc->bit;
+	rc->nremoved++;
+	rc->nbytes += sb.st_size;
+	return 1;
+} // rcfile()
+
+static int
+gone(const char *path)
+{ /* Return 1 if nothing is at path. */
+	struct stat sb;
+	st_add(ST_STAT, 1);
+	if (lstat(path, &sb) == 0) return 0;
+	return errno == ENOENT || errno == ENOTDIR;
+} // gone()
+
+static void
+addent(rc_ent **ents, size_t *n, size_t *size, ino_t tino, mf_dir *md,
+			mf_kid *kid, char *path)
+{ /* Append an entry to a table. */
+	if (*n == *size) {
+		*size = (*size) ? 2 * *size : 1024;
+		*ents = realloc(*ents, *size * sizeof(rc_ent));
+		if (!*ents) {
+			fputs("Out of memory.\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	rc_ent *e = &(*ents)[(*n)++];
+	e->tino = tino;
+	e->md = md;
+	e->kid = kid;
+	e->path = path;
+	e->found = 0;
+} // addent()
+
+static int
+entcmp(const void *a, const void *b)
+{ /* qsort() and bsearch() by tino. */
+	ino_t x = ((const rc_ent *)a)->tino;
+	ino_t y = ((const rc_ent *)b)->tino;
+	return (x > y) - (x < y);
+} // entcmp()
+
+static int
+dircmp(const void *a, const void *b)
+{ /* qsort() and bsearch() by path. */
+	return strcmp(((const rc_ent *)a)->path, ((const rc_ent *)b)->path);
+} // dircmp()
+
+static rc_ent
+*findent(rc_ent *ents, size_t n, ino_t tino, const char *name)
+{ /* Return the entry for tino, NULL if none. Files linked under more
+   * than one name share a tino, so if name is given the entry must be
+   * for that name too.
+*/
+	rc_ent key;
+	key.tino = tino;
+	rc_ent *e = bsearch(&key, ents, n, sizeof(rc_ent), entcmp);
+	if (!e || !name) return e;
+	while (e > ents && (e - 1)->tino == tino) e--;
+	for (; e < ents + n && e->tino == tino; e++) {
+		if (strcmp(e->kid->name, name) == 0) return e;
+	}
+	return NULL;
+} // findent()
+
+static rc_ent
+*finddir(rc_data *rc, const char *path)
+{ /* Return the entry of the dir whose source is path, NULL if none. */
+	rc_ent key;
+	key.path = (char *)path;
+	return bsearch(&key, rc->dirs, rc->ndirs, sizeof(rc_ent), dircmp);
+} // finddir()
@@ -0,0 +1,90 @@
+/*    reconcile.h
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of reconcile.[h|c] is to remove target files whose source
+ * has gone, deleted or renamed, which a run otherwise leaves behind in
+ * the cloud dir for ever. Only the target is walked. Files are looked
+ * up by inode in a table made from the manifest, so files the manifest
+ * doesn't know of, eg those the cloud client brought from elsewhere,
+ * are never touched. A copy on another file system than its source has
+ * an inode of its own in each target, and only the first is recorded,
+ * so a file not found by inode is looked up by the path of its source.
+ * Dirs are looked up by the path of their source, their record holds
+ * one inode for all the targets. A known target is an orphan if its
+ * source is gone and either it has no other link, it is recorded as
+ * gone, or its dir was not seen this run. Dirs the manifest knows of
+ * that end up empty, and whose source is gone, are removed bottom up.
+ * */
+
+#ifndef _RECONCILE_H
+#define _RECONCILE_H
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <errno.h>
+#include "str.h"
+#include "dirs.h"
+#include "manifest.h"
+
+typedef struct rc_ent {	// a target the manifest knows of.
+	ino_t tino;
+	mf_dir *md;		// the record it's in.
+	mf_kid *kid;	// NULL if it's the target of md itself.
+	char *path;		// of the source dir of md, owned by the manifest.
+	unsigned found;	// bit k set if still in target k after its walk.
+} rc_ent;
+
+typedef struct rc_data {
+	manifest *mf;
+	int dryrun;			// report what would be removed, remove nothing.
+	unsigned bit;		// of the target being walked, in rc_ent.found.
+	rc_ent *files;		// sorted by tino.
+	hash_t *copies;		// the files by source path, for copies.
+	rc_ent *dirs;		// sorted by path.
+	size_t nfiles, ndirs;
+	size_t nremoved;	// orphan files.
+	size_t npruned;		// empty dirs.
+	long long nbytes;	// size of the orphans.
+} rc_data;
+
+rc_data
+*init_reconcile(manifest *mf, int dryrun);
+
+void
+free_reconcile(rc_data *rc);
+
+void
+reconcile(rc_data *rc, size_t k, const char *srcdir, const char *dstdir,
+			const char *skip);
+
+void
+rc_prune(rc_data *rc);
+
+void
+reconcile_report(rc_data *rc);
+
+#endif
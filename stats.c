@@ -0,0 +1,184 @@
+/*    stats.c
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of stats.[h|c] is to count the system calls and memory
+ * growth of a run and to time its phases. See stats.h.
+ * */
+
+#include "stats.h"
+#include "str.h"
+
+typedef struct st_timer {
+	char *name;
+	double secs;
+	size_t calls;
+} st_timer;
+
+typedef struct st_timers {
+	st_timer *t;
+	size_t count, size;
+} st_timers;
+
+int st_on;
+unsigned long st_count[ST_NCOUNTERS];
+
+static const char *st_names[ST_NCOUNTERS] = {
+	"opendir", "getdents", "stat", "mkdir", "link", "copy",
+	"bytes_read", "reallocs", "grow_bytes"
+};
+static st_timers phases, dirs;
+static pthread_mutex_t st_lock = PTHREAD_MUTEX_INITIALIZER;	// timers.
+static double st_begin;
+
+static void
+st_addtime(st_timers *ts, const char *name, double secs);
+static void
+st_atexit(void);
+static void
+st_jsonstr(FILE *fp, const char *s);
+
+void
+st_start(int format)
+{ /* Start counting and timing, the report is printed to stderr on exit
+   * as text or JSON according to format.
+*/
+	st_on = format;
+	st_begin = st_now();
+	atexit(st_atexit);
+} // st_start()
+
+double
+st_now(void)
+{ /* Monotonic time in seconds. */
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+} // st_now()
+
+void
+st_phase(const char *name, double since)
+{ /* Add the time from since until now to the phase name. */
+	if (st_on) st_addtime(&phases, name, st_now() - since);
+} // st_phase()
+
+void
+st_dir(const char *name, double since)
+{ /* Add the time from since until now to the top level dir name. */
+	if (st_on) st_addtime(&dirs, name, st_now() - since);
+} // st_dir()
+
+void
+st_report(FILE *fp)
+{ /* Print the counts and times. */
+	double total = st_now() - st_begin;
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru) == -1) ru.ru_maxrss = 0;
+	size_t i;
+	if (st_on == ST_JSON) {
+		fprintf(fp, "{\n  \"seconds\": %.6f,\n  \"max_rss_kb\": %ld,\n"
+				"  \"counts\": {", total, ru.ru_maxrss);
+		for (i = 0; i < ST_NCOUNTERS; i++) {
+			fprintf(fp, "%s\"%s\": %lu", (i) ? ", " : "", st_names[i],
+					st_count[i]);
+		}
+		fputs("},\n  \"phases\": {", fp);
+		for (i = 0; i < phases.count; i++) {
+			fputs((i) ? ",\n    " : "\n    ", fp);
+			st_jsonstr(fp, phases.t[i].name);
+			fprintf(fp, ": {\"seconds\": %.6f, \"calls\": %lu}",
+					phases.t[i].secs, phases.t[i].calls);
+		}
+		fputs("\n  },\n  \"dirs\": {", fp);
+		for (i = 0; i < dirs.count; i++) {
+			fputs((i) ? ",\n    " : "\n    ", fp);
+			st_jsonstr(fp, dirs.t[i].name);
+			fprintf(fp, ": %.6f", dirs.t[i].secs);
+		}
+		fputs("\n  }\n}\n", fp);
+		return;
+	}
+	fprintf(fp, "Run time: %.3f s\n", total);
+	fprintf(fp, "%-14s %12ld\n", "max_rss_kb", ru.ru_maxrss);
+	for (i = 0; i < ST_NCOUNTERS; i++) {
+		fprintf(fp, "%-14s %12lu\n", st_names[i], st_count[i]);
+	}
+	fputs("Phases:\n", fp);
+	for (i = 0; i < phases.count; i++) {
+		fprintf(fp, "  %-14s %10.3f s %8lu calls\n", phases.t[i].name,
+				phases.t[i].secs, phases.t[i].calls);
+	}
+	fputs("Top level dirs:\n", fp);
+	for (i = 0; i < dirs.count; i++) {
+		fprintf(fp, "  %10.3f s  %s\n", dirs.t[i].secs, dirs.t[i].name);
+	}
+} // st_report()
+
+static void
+st_addtime(st_timers *ts, const char *name, double secs)
+{ /* Add secs to the timer called name, making it if need be. There are
+   * few phases and each dir is timed once, so a list is searched.
+*/
+	size_t i;
+	pthread_mutex_lock(&st_lock);
+	for (i = 0; i < ts->count; i++) {
+		if (strcmp(ts->t[i].name, name) == 0) break;
+	}
+	if (i == ts->count) {
+		if (ts->count == ts->size) {
+			ts->size = (ts->size) ? 2 * ts->size : 16;
+			ts->t = realloc(ts->t, ts->size * sizeof(st_timer));
+			if (!ts->t) {
+				fputs("Out of memory.\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+		}
+		ts->t[i].name = xstrdup((char *)name);
+		ts->t[i].secs = 0;
+		ts->t[i].calls = 0;
+		ts->count++;
+	}
+	ts->t[i].secs += secs;
+	ts->t[i].calls++;
+	pthread_mutex_unlock(&st_lock);
+} // st_addtime()
+
+static void
+st_atexit(void)
+{ /* Registered by st_start(). */
+	fflush(stdout);
+	st_report(stderr);
+} // st_atexit()
+
+static void
+st_jsonstr(FILE *fp, const char *s)
+{ /* Print s as a JSON string. */
+	fputc('"', fp);
+	for (; *s; s++) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\') {
+			fprintf(fp, "\\%c", c);
+		} else if (c < 0x20) {
+			fprintf(fp, "\\u%04x", c);
+		} else {
+			fputc(c, fp);
+		}
+	}
+	fputc('"', fp);
+} // st_jsonstr()
@@ -0,0 +1,77 @@
+/*    stats.h
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of stats.[h|c] is to count the system calls and memory
+ * growth of a run and to time its phases, so that a slow run can be
+ * explained. Nothing is counted or timed until st_start() is called,
+ * then the report is printed on exit, with the peak memory use of the
+ * run. Counting and timing are both safe from any thread.
+ * */
+
+#ifndef _STATS_H
+#define _STATS_H
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+enum {	// what st_add() counts.
+	ST_OPENDIR,		// dirs opened.
+	ST_GETDENTS,	// getdents64() calls, each reads many entries.
+	ST_STAT,		// stat, fstatat or statx calls.
+	ST_MKDIR,		// dirs made, or tried.
+	ST_LINK,		// hard links made, or tried.
+	ST_COPY,		// files copied because they could not be linked.
+	ST_READBYTES,	// bytes read by readfile() and mapfile().
+	ST_REALLOCS,	// data blocks grown by meminsert() or memresize().
+	ST_GROWBYTES,	// bytes those blocks grew by.
+	ST_NCOUNTERS
+};
+
+enum { ST_TEXT = 1, ST_JSON };	// st_start() formats.
+
+extern int st_on;
+extern unsigned long st_count[ST_NCOUNTERS];
+
+static inline void
+st_add(int which, unsigned long n)
+{ /* Count n more of which, if counting. */
+	if (st_on) __atomic_fetch_add(&st_count[which], n, __ATOMIC_RELAXED);
+}
+
+void
+st_start(int format);
+
+double
+st_now(void);
+
+void
+st_phase(const char *name, double since);
+
+void
+st_dir(const char *name, double since);
+
+void
+st_report(FILE *fp);
+
+#endif
@@ -25,6 +25,28 @@
 
 #include "str.h"
 
+/* countmemstr(), memlinestostr() and memstrtolines() all come down to
+ * finding every instance of one byte in a block and maybe replacing it.
+ * That is done by memswap(), which calls the widest vector version the
+ * CPU has, chosen on first use. Any odd bytes at the end of a block are
+ * done by the plain byte at a time version, which is also what is used
+ * on CPUs without SSE2.
+ * */
+typedef size_t (*swapfn)(char *fro, char *to, char find, char repl);
+
+static size_t
+memswap(char *fro, char *to, char find, char repl);
+static size_t
+swap_scalar(char *fro, char *to, char find, char repl);
+#ifdef __SSE2__
+static size_t
+swap_sse2(char *fro, char *to, char find, char repl);
+static size_t
+swap_avx2(char *fro, char *to, char find, char repl);
+static size_t
+swap_avx512(char *fro, char *to, char find, char repl);
+#endif
+
 size_t
 lenrequired(size_t nominal_len)
 { /* Ensure that memory operations always have 8 bytes to spare. */
@@ -35,13 +57,7 @@ lenrequired(size_t nominal_len)
 size_t
 countmemstr(mdata *md)
 { /* In memory block specified by md, count the number of C strings. */
-	char *cp = md->fro;
-	size_t c = 0;
-	while (cp < md->to) {
-		if (*cp == 0) c++;
-		cp++;
-	}
-	return c;
+	return memswap(md->fro, md->to, 0, 0);
 } // countmemlines()
 
 char
@@ -86,30 +102,128 @@ meminsert(const char *line, mdata *dd, size_t meminc)
 	size_t len = strlen(line);
 	size_t safelen = lenrequired(len);
 	if (safelen > (unsigned)(dd->limit - dd->to)) { // >= 0 always
-		/* Ensure that line always has room to fit. */
+		/* Ensure that line always has room to fit, growing by at least
+		 * the present size so that n inserts cost O(n) copying. The new
+		 * space is not zeroed, unlike memresize(), nothing reads it. */
+		size_t now = dd->limit - dd->fro;
+		size_t dlen = dd->to - dd->fro;
 		size_t needed = (meminc > safelen) ? meminc : safelen;
-		memresize(dd, needed);
+		if (needed < now) needed = now;
+		st_add(ST_REALLOCS, 1);
+		st_add(ST_GROWBYTES, needed);
+		dd->fro = realloc(dd->fro, now + needed);
+		if (!dd->fro) {
+			fputs("Out of memory\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		dd->limit = dd->fro + now + needed;
+		dd->to = dd->fro + dlen;
 	}
 	strcpy(dd->to, line);
 	dd->to += len+1;
 } // meminsert()
 
-/* There's a bug in memreplace(). It manifests as dofopen() segfaulting
- * when run immediately after a run of memreplace(). dofopen() should
- * never segfault, it can and should abort when there is some problem
- * with the file it's trying to open. So I am clobbering some memory, I
- * suppose with some kind of write beyond my malloc'd space.
- *
- * The problem happens when available space is == space needed or
- * available space is 1 more than space needed.
- * If available space is 1 less than needed, a resize is forced and all
- * is well. If available space is 2 more than needed it works as well.
- *
- * If I am off by 1 somewhere I can't see where. Is memmove() doing
- * something it shouldn't oughta?
- *
- * Workaround - I'll put an 8 byte fudge fence into the thing.
- * */
+sarena
+*init_sarena(size_t chunksize)
+{ /* An empty arena whose first chunk will hold chunksize bytes. Unlike
+   * an mdata block the arena grows by adding chunks, so strings never
+   * move, and each is indexed as it goes in.
+*/
+	sarena *sa = xmalloc(sizeof(sarena));
+	memset(sa, 0, sizeof(sarena));
+	sa->chunksize = (chunksize) ? chunksize : 64 * 1024;
+	return sa;
+} // init_sarena()
+
+void
+free_sarena(sarena *sa)
+{ /* free resources allocated by init_sarena() and sa_insert() */
+	if (!sa) return;
+	sa_chunk *ch = sa->head;
+	while (ch) {
+		sa_chunk *next = ch->next;
+		free(ch);
+		ch = next;
+	}
+	free(sa->index);
+	free(sa);
+} // free_sarena()
+
+char
+*sa_insert(sarena *sa, const char *s)
+{ /* Copy s into the arena and return where it now lives. */
+	const size_t maxchunk = 64 * 1024 * 1024;
+	size_t len = strlen(s) + 1;
+	sa_chunk *ch = sa->tail;
+	if (!ch || ch->size - ch->used < len) {
+		size_t size = (sa->chunksize > len) ? sa->chunksize : len;
+		ch = xmalloc(sizeof(sa_chunk) + size);
+		ch->next = NULL;
+		ch->size = size;
+		ch->used = 0;
+		if (sa->tail) {
+			sa->tail->next = ch;
+		} else {
+			sa->head = ch;
+		}
+		sa->tail = ch;
+		if (sa->chunksize < maxchunk) sa->chunksize *= 2;
+	}
+	char *ret = ch->data + ch->used;
+	memcpy(ret, s, len);
+	ch->used += len;
+	if (sa->count == sa->isize) {
+		sa->isize = (sa->isize) ? sa->isize * 2 : 1024;
+		sa->index = realloc(sa->index, sa->isize * sizeof(char *));
+		if (!sa->index) {
+			fputs("Out of memory.\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	sa->index[sa->count++] = ret;
+	return ret;
+} // sa_insert()
+
+void
+sa_append(sarena *to, sarena *from)
+{ /* Move every string of from to the end of to, leaving from empty.
+   * Only the chunk list and the index are touched, no string is copied.
+*/
+	if (!from->count && !from->head) return;
+	if (to->tail) {
+		to->tail->next = from->head;
+	} else {
+		to->head = from->head;
+	}
+	if (from->tail) to->tail = from->tail;
+	if (to->count + from->count > to->isize) {
+		to->isize = to->count + from->count;
+		to->index = realloc(to->index, to->isize * sizeof(char *));
+		if (!to->index) {
+			fputs("Out of memory.\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	memcpy(to->index + to->count, from->index,
+			from->count * sizeof(char *));
+	to->count += from->count;
+	free(from->index);
+	from->head = from->tail = NULL;
+	from->index = NULL;
+	from->count = from->isize = 0;
+} // sa_append()
+
+char
+**sa_toarray(sarena *sa)
+{ /* Return a NULL terminated array of copies of the strings of sa, as
+   * memblocktoarray() does for an mdata block.
+*/
+	char **result = xmalloc((sa->count + 1) * sizeof(char *));
+	size_t i;
+	for (i = 0; i < sa->count; i++) result[i] = xstrdup(sa->index[i]);
+	result[i] = NULL;
+	return result;
+} // sa_toarray()
 
 int
 printstrlist(char **list)
@@ -123,33 +237,72 @@ printstrlist(char **list)
 
 void
 memreplace(mdata *md, char *find, char *repl, off_t meminc)
-{/* Replace find with repl for every occurrence in the data block md. */
+{/* Replace find with repl for every occurrence in the data block md.
+  * The block is scanned once. If repl is no longer than find the block
+  * is rewritten in place, front to back, as the writes can never pass
+  * the reads. Otherwise the matches are noted as they are found, the
+  * final size worked out and the result built in a new block with
+  * meminc bytes to spare. Text put in by repl is never searched again.
+*/
 	size_t flen = strlen(find);
 	size_t rlen = strlen(repl);
-	off_t ldiff = rlen - flen;
-	const off_t fudge_fence = 8;	// see bug commentary above.
-	char *fp = md->fro;
-	fp = memmem(fp, md->to - fp, find, flen);
-	while (fp) {
-		off_t avail = md->limit - md->to;
-		if (ldiff + fudge_fence > avail) {
-			off_t fpoffset = fp - md->fro;	// Handle relocation.
-			// Ensure that the resized memory has space to fit new data.
-			off_t actualinc = (meminc > ldiff)
-								? meminc : ldiff + fudge_fence;
-			/* Ensure that we never have available space within 0 or 1
-			 * bytes of the needed space. */
-			memresize(md, actualinc);
-			fp = md->fro + fpoffset;
+	if (!flen) return;
+	char *rp = md->fro;	// read from here.
+	if (rlen <= flen) {
+		char *wp = md->fro;
+		char *fp;
+		while ((fp = memmem(rp, md->to - rp, find, flen))) {
+			size_t seg = fp - rp;
+			if (wp != rp) memmove(wp, rp, seg);
+			wp += seg;
+			memcpy(wp, repl, rlen);
+			wp += rlen;
+			rp = fp + flen;
 		}
-		char *movefro = fp + flen;
-		char *moveto = fp + rlen;
-		size_t mlen = md->to - fp;
-		memmove(moveto, movefro, mlen);
-		memcpy(fp, repl, rlen);
-		md->to += ldiff;
-		fp = memmem(fp, md->to - fp, find, flen);
-	} // while(fp)
+		if (rp == md->fro) return;	// no match.
+		size_t tail = md->to - rp;
+		memmove(wp, rp, tail);
+		md->to = wp + tail;
+		return;
+	}
+	size_t n = 0, size = 0;
+	size_t *offs = NULL;	// of each match from md->fro.
+	char *fp;
+	while ((fp = memmem(rp, md->to - rp, find, flen))) {
+		if (n == size) {
+			size = (size) ? size * 2 : 64;
+			offs = realloc(offs, size * sizeof(size_t));
+			if (!offs) {
+				fputs("Out of memory\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+		}
+		offs[n++] = fp - md->fro;
+		rp = fp + flen;
+	}
+	if (!n) return;
+	size_t oldlen = md->to - md->fro;
+	size_t newlen = oldlen + n * (rlen - flen);
+	size_t spare = (meminc > 0) ? meminc : 0;
+	char *nb = xmalloc(newlen + spare);
+	char *wp = nb;
+	rp = md->fro;
+	size_t i;
+	for (i = 0; i < n; i++) {
+		char *mp = md->fro + offs[i];
+		memcpy(wp, rp, mp - rp);
+		wp += mp - rp;
+		memcpy(wp, repl, rlen);
+		wp += rlen;
+		rp = mp + flen;
+	}
+	memcpy(wp, rp, md->to - rp);
+	free(offs);
+	free(md->fro);
+	md->fro = nb;
+	md->to = nb + newlen;
+	md->limit = md->to + spare;
+	memset(md->to, 0, spare);	// as memresize() would have left it.
 } // memreplace()
 
 void
@@ -162,6 +315,10 @@ memresize(mdata *dd, off_t change)
 	size_t now = dd->limit - dd->fro;
 	size_t dlen = dd->to - dd->fro;
 	size_t newsize = now + change;	// change can be negative
+	if (change > 0) {
+		st_add(ST_REALLOCS, 1);
+		st_add(ST_GROWBYTES, change);
+	}
 	dd->fro = realloc(dd->fro, newsize);
 	if (!dd->fro) {
 		fputs("Out of memory\n", stderr);
@@ -179,16 +336,7 @@ memlinestostr(mdata *md)
 { /* In the block of memory enumerated by md, replace all '\n' with
    * '\0' and return the number of replacements done.
   */
-	size_t lcount = 0;
-	char *cp = md->fro;
-	while (cp < md->to) {
-		if (*cp == '\n') {
-			*cp = 0;
-			lcount++;
-		}
-		cp++;
-	}
-	return lcount;
+	return memswap(md->fro, md->to, '\n', 0);
 } // memlinestostr()
 
 size_t
@@ -196,17 +344,115 @@ memstrtolines(mdata *md)
 { /* In the block of memory enumerated by md, replace all '\0' with
    * '\n' and return the number of replacements done.
   */
-	size_t scount = 0;
-	char *cp = md->fro;
-	while (cp < md->to) {
-		if (*cp == 0) {
-			*cp = '\n';
-			scount++;
+	return memswap(md->fro, md->to, 0, '\n');
+} // memstrtolines()
+
+static size_t
+memswap(char *fro, char *to, char find, char repl)
+{ /* Replace every find between fro and to with repl and return how many
+   * there were. If find and repl are the same nothing is written, the
+   * bytes are just counted.
+*/
+	static swapfn fn;
+	swapfn f = __atomic_load_n(&fn, __ATOMIC_RELAXED);
+	if (!f) {
+		f = swap_scalar;
+#ifdef __SSE2__
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512bw")) {
+			f = swap_avx512;
+		} else if (__builtin_cpu_supports("avx2")) {
+			f = swap_avx2;
+		} else {
+			f = swap_sse2;
 		}
-		cp++;
+#endif
+		__atomic_store_n(&fn, f, __ATOMIC_RELAXED);
 	}
-	return scount;
-} // memstrtolines()
+	if (to <= fro) return 0;
+	return f(fro, to, find, repl);
+} // memswap()
+
+static size_t
+swap_scalar(char *fro, char *to, char find, char repl)
+{ /* Byte at a time memswap(), for reference and for the odd bytes. */
+	size_t count = 0;
+	char *cp;
+	for (cp = fro; cp < to; cp++) {
+		if (*cp == find) {
+			*cp = repl;
+			count++;
+		}
+	}
+	return count;
+} // swap_scalar()
+
+#ifdef __SSE2__
+static size_t
+swap_sse2(char *fro, char *to, char find, char repl)
+{ /* memswap() 16 bytes at a time. */
+	const __m128i vf = _mm_set1_epi8(find);
+	const __m128i vr = _mm_set1_epi8(repl);
+	int write = (find != repl);
+	size_t count = 0;
+	char *cp = fro;
+	for (; to - cp >= 16; cp += 16) {
+		__m128i v = _mm_loadu_si128((__m128i *)cp);
+		__m128i eq = _mm_cmpeq_epi8(v, vf);
+		unsigned mask = _mm_movemask_epi8(eq);
+		if (!mask) continue;
+		count += __builtin_popcount(mask);
+		if (write) {
+			v = _mm_or_si128(_mm_andnot_si128(eq, v),
+								_mm_and_si128(eq, vr));
+			_mm_storeu_si128((__m128i *)cp, v);
+		}
+	}
+	return count + swap_scalar(cp, to, find, repl);
+} // swap_sse2()
+
+__attribute__ ((target("avx2")))
+static size_t
+swap_avx2(char *fro, char *to, char find, char repl)
+{ /* memswap() 32 bytes at a time. */
+	const __m256i vf = _mm256_set1_epi8(find);
+	const __m256i vr = _mm256_set1_epi8(repl);
+	int write = (find != repl);
+	size_t count = 0;
+	char *cp = fro;
+	for (; to - cp >= 32; cp += 32) {
+		__m256i v = _mm256_loadu_si256((__m256i *)cp);
+		__m256i eq = _mm256_cmpeq_epi8(v, vf);
+		unsigned mask = _mm256_movemask_epi8(eq);
+		if (!mask) continue;
+		count += __builtin_popcount(mask);
+		if (write) {
+			_mm256_storeu_si256((__m256i *)cp,
+								_mm256_blendv_epi8(v, vr, eq));
+		}
+	}
+	return count + swap_sse2(cp, to, find, repl);
+} // swap_avx2()
+
+__attribute__ ((target("avx512f,avx512bw")))
+static size_t
+swap_avx512(char *fro, char *to, char find, char repl)
+{ /* memswap() 64 bytes at a time. */
+	const __m512i vf = _mm512_set1_epi8(find);
+	const __m512i vr = _mm512_set1_epi8(repl);
+	int write = (find != repl);
+	size_t count = 0;
+	char *cp = fro;
+	for (; to - cp >= 64; cp += 64) {
+		__m512i v = _mm512_loadu_si512((void *)cp);
+		__mmask64 mask = _mm512_cmpeq_epi8_mask(v, vf);
+		if (!mask) continue;
+		count += __builtin_popcountll(mask);
+		if (write) _mm512_mask_storeu_epi8(cp, mask, vr);
+	}
+	return count + swap_avx2(cp, to, find, repl);
+} // swap_avx512()
+#endif
 
 void
 strjoin(char *left, char sep, char *right, size_t max)
@@ -263,35 +509,6 @@ void
 	return p;
 } // xmalloc()
 
-char
-*getcfgdata(mdata *cfdat, char *cfgid)
-{/* Read selected line */
-	static char buf[NAME_MAX];
-	buf[0] = 0;
-	char *cp = cfdat->fro;
-	size_t slen = strlen(cfgid);
-	cp = memmem(cp, cfdat->to - cp, cfgid, slen);
-	if (!cp) {
-		fprintf(stderr, "No such parameter in config: %s\n", cfgid);
-		exit(EXIT_FAILURE);
-	}
-	cp = memchr(cp, '=', cfdat->to - cp);
-	if (!cp) {
-		fprintf(stderr, "Malformed line in config: %s\n", cfgid);
-		exit(EXIT_FAILURE);
-	}
-	cp++;	// step past '='
-	char *ep = memchr(cp, '\n', cfdat->to - cp);
-	if (!cp) {
-		fprintf(stderr, "WTF??? no line feed in config: %s\n", cfgid);
-		exit(EXIT_FAILURE);
-	}
-	size_t dlen = ep - cp;
-	strncpy(buf, cp, dlen);
-	buf[dlen] = 0;
-	return buf;
-} // getgfgdata()
-
 void
 free_mdata(mdata *md)
 {/* Free the data pointed to by md, then free md itself. */
@@ -418,3 +635,21 @@ in_uch_array(const unsigned char c, unsigned char *buf)
 	}
 	return 0;
 } // in_uch_array()
+
+char
+**memblocktoarray(mdata *md, size_t count)
+{ /* Make a NULL terminated array of copies of the C strings in the
+   * block described by md. If count is 0 the strings will be counted,
+   * otherwise only the first count strings are taken.
+*/
+	if (!count) count = countmemstr(md);
+	char **result = xmalloc((count + 1) * sizeof(char *));
+	char *cp = md->fro;
+	size_t i;
+	for (i = 0; i < count; i++) {
+		result[i] = xstrdup(cp);
+		cp += strlen(cp) + 1;
+	}
+	result[count] = (char *)NULL;
+	return result;
+} // memblocktoarray()
@@ -40,6 +40,10 @@
 #include <linux/limits.h>
 #include <libgen.h>
 #include <errno.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+#include "stats.h"
 
 typedef struct mdata {
 	char *fro;
@@ -47,6 +51,19 @@ typedef struct mdata {
 	char *limit;
 } mdata;
 
+typedef struct sa_chunk {	// a block of the arena, strings never move.
+	struct sa_chunk *next;
+	size_t size, used;
+	char data[];
+} sa_chunk;
+
+typedef struct sarena {	// an append only store of C strings.
+	sa_chunk *head, *tail;
+	size_t chunksize;	// of the next chunk, doubles each time.
+	char **index;		// every string in the order inserted.
+	size_t count, isize;
+} sarena;
+
 int
 printstrlist(char **list);
 
@@ -71,6 +88,21 @@ void
 void
 meminsert(const char *line, mdata *md, size_t meminc);
 
+sarena
+*init_sarena(size_t chunksize);
+
+void
+free_sarena(sarena *sa);
+
+char
+*sa_insert(sarena *sa, const char *s);
+
+void
+sa_append(sarena *to, sarena *from);
+
+char
+**sa_toarray(sarena *sa);
+
 void
 memreplace(mdata *md, char *find , char *repl, off_t meminc);
 
@@ -89,9 +121,6 @@ strjoin(char *buf, char sep, char *tojoin, size_t bufsize);
 char
 *xstrdup(char *s);
 
-char
-*getcfgdata(mdata *md, char *configid);
-
 void
 vfree(void *, ...);
 
@@ -110,4 +139,7 @@ instrlist(const char *find, char **list);
 int
 in_uch_array(const unsigned char, unsigned char *);
 
+char
+**memblocktoarray(mdata *md, size_t count);
+
 #endif
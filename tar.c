@@ -0,0 +1,357 @@
+/*    tar.c
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of tar.[h|c] is to put a dir tree into one compressed
+ * tarball. See tar.h.
+ * */
+
+#include "tar.h"
+
+#define TAR_BLOCK 512
+
+static struct sigaction oldpipe;	// restored by tar_endcompressor().
+
+static void
+scantree(tar_list *tl, int pfd, const char *name, char *path,
+			size_t baselen, excl_t *excl);
+static void
+addent(tar_list *tl, const char *name, struct stat *sb);
+static void
+writeheader(FILE *fp, const char *name, char type, tar_ent *e,
+			off_t size, const char *link);
+static void
+writelong(FILE *fp, char type, const char *s);
+static void
+octal(char *field, size_t len, unsigned long long val);
+static void
+writedata(FILE *fp, int fd, off_t size, const char *path);
+static void
+writepad(FILE *fp, off_t size);
+static void
+dowrite(FILE *fp, const void *buf, size_t len);
+
+tar_list
+*tar_scan(const char *base, const char *dir, excl_t *excl)
+{ /* List dir and everything under it, named relative to base which must
+   * be a leading part of dir. Excluded dirs are left out. Entries that
+   * can't be read are left out with a warning.
+*/
+	tar_list *tl = xmalloc(sizeof(tar_list));
+	memset(tl, 0, sizeof(tar_list));
+	tl->names = init_sarena(0);
+	char path[PATH_MAX];
+	strcpy(path, dir);
+	size_t baselen = strlen(base) + 1;	// and the '/'
+	struct stat sb;
+	if (lstat(dir, &sb) == -1) {
+		perror(dir);
+		exit(EXIT_FAILURE);
+	}
+	addent(tl, path + baselen, &sb);
+	scantree(tl, AT_FDCWD, dir, path, baselen, excl);
+	return tl;
+} // tar_scan()
+
+void
+free_tarlist(tar_list *tl)
+{ /* free resources allocated by tar_scan() */
+	free_sarena(tl->names);
+	free(tl->ents);
+	free(tl);
+} // free_tarlist()
+
+FILE
+*tar_compressor(const char *path, pid_t *pid)
+{ /* Start pigz, or gzip if pigz is not installed, compressing into the
+   * file path. Returns the stream to write the tarball to, which must
+   * be finished with tar_endcompressor().
+*/
+	int out = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (out == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) == -1) {
+		perror("pipe");
+		exit(EXIT_FAILURE);
+	}
+	*pid = fork();
+	if (*pid == -1) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if (*pid == 0) {	// dup2() clears O_CLOEXEC on the copies.
+		if (dup2(fds[0], 0) == -1 || dup2(out, 1) == -1) _exit(127);
+		execlp("pigz", "pigz", "-c", (char *)NULL);
+		execlp("gzip", "gzip", "-c", (char *)NULL);
+		perror("gzip");
+		_exit(127);
+	}
+	close(fds[0]);
+	close(out);
+	struct sigaction sa;	// a dead compressor is an EPIPE, until reaped.
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, &oldpipe);
+	FILE *fp = fdopen(fds[1], "w");
+	if (!fp) {
+		perror("fdopen");
+		exit(EXIT_FAILURE);
+	}
+	return fp;
+} // tar_compressor()
+
+void
+tar_endcompressor(FILE *fp, pid_t pid, const char *path)
+{ /* Close the stream from tar_compressor() and wait for the compressor
+   * to finish, then put back the SIGPIPE action it replaced. Failure is
+   * fatal.
+*/
+	if (fclose(fp) == EOF) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	int status;
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno == EINTR) continue;
+		perror("waitpid");
+		exit(EXIT_FAILURE);
+	}
+	sigaction(SIGPIPE, &oldpipe, NULL);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "Compressing %s failed.\n", path);
+		exit(EXIT_FAILURE);
+	}
+} // tar_endcompressor()
+
+void
+tar_write(FILE *fp, tar_list *tl, const char *base)
+{ /* Write every entry of tl, the names being relative to base, and the
+   * end of archive. A file that changed size since tar_scan() is cut
+   * or padded to the size listed.
+*/
+	char path[PATH_MAX];
+	strcpy(path, base);
+	size_t blen = strlen(path);
+	size_t i;
+	for (i = 0; i < tl->count; i++) {
+		tar_ent *e = &tl->ents[i];
+		pathjoin(path, blen, e->name);
+		if (S_ISDIR(e->mode)) {
+			char name[PATH_MAX];
+			strcpy(name, e->name);
+			strjoin(name, 0, "/", PATH_MAX);
+			writeheader(fp, name, '5', e, 0, NULL);
+		} else if (S_ISLNK(e->mode)) {
+			char link[PATH_MAX];
+			ssize_t len = readlink(path, link, PATH_MAX - 1);
+			if (len == -1) {
+				perror(path);
+				continue;
+			}
+			link[len] = 0;
+			writeheader(fp, e->name, '2', e, 0, link);
+		} else {
+			int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+			if (fd == -1) {
+				perror(path);
+				continue;
+			}
+			writeheader(fp, e->name, '0', e, e->size, NULL);
+			writedata(fp, fd, e->size, path);
+			close(fd);
+		}
+	}
+	char end[2 * TAR_BLOCK];
+	memset(end, 0, sizeof(end));
+	dowrite(fp, end, sizeof(end));
+} // tar_write()
+
+static void
+scantree(tar_list *tl, int pfd, const char *name, char *path,
+			size_t baselen, excl_t *excl)
+{ /* Add what is in the dir name in pfd, whose path is path, recursing
+   * into sub-dirs. Path is extended and restored in place.
+*/
+	dr_data dr;
+	if (dr_open(&dr, pfd, name) == -1) {
+		perror(path);
+		return;
+	}
+	size_t plen = strlen(path);
+	dr_ent ent, *de;
+	while ((de = dr_read(&dr, &ent))) {
+		struct stat sb;
+		st_add(ST_STAT, 1);
+		if (fstatat(dr.fd, de->name, &sb, AT_SYMLINK_NOFOLLOW) == -1)
+			continue;	// gone since it was read.
+		pathjoin(path, plen, de->name);
+		if (S_ISDIR(sb.st_mode)) {
+			if (excluded(excl, path)) continue;
+			addent(tl, path + baselen, &sb);
+			scantree(tl, dr.fd, de->name, path, baselen, excl);
+		} else if (S_ISREG(sb.st_mode) || S_ISLNK(sb.st_mode)) {
+			addent(tl, path + baselen, &sb);
+		}	// sockets, fifos and devices are no use in a backup.
+	}
+	path[plen] = 0;
+	dr_close(&dr);
+} // scantree()
+
+static void
+addent(tar_list *tl, const char *name, struct stat *sb)
+{ /* Append a member and note its times. */
+	if (tl->count == tl->size) {
+		tl->size = (tl->size) ? 2 * tl->size : 256;
+		tl->ents = realloc(tl->ents, tl->size * sizeof(tar_ent));
+		if (!tl->ents) {
+			fputs("Out of memory.\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	tar_ent *e = &tl->ents[tl->count++];
+	e->name = sa_insert(tl->names, name);
+	e->mode = sb->st_mode;
+	e->uid = sb->st_uid;
+	e->gid = sb->st_gid;
+	e->size = (S_ISREG(sb->st_mode)) ? sb->st_size : 0;
+	e->mtime = sb->st_mtime;
+	tl->bytes += e->size;
+	/* A ctime catches renames and removals, which don't touch mtimes of
+	 * the files involved. */
+	long long m = sb->st_mtim.tv_sec * 1000000000LL + sb->st_mtim.tv_nsec;
+	long long c = sb->st_ctim.tv_sec * 1000000000LL + sb->st_ctim.tv_nsec;
+	if (m > tl->newest) tl->newest = m;
+	if (c > tl->newest) tl->newest = c;
+} // addent()
+
+static void
+writeheader(FILE *fp, const char *name, char type, tar_ent *e,
+			off_t size, const char *link)
+{ /* Write the ustar header of a member, preceded by GNU long name or
+   * long link records if name or link won't fit.
+*/
+	size_t nlen = strlen(name);
+	const char *prefix = NULL;
+	size_t plen = 0;
+	if (nlen > 100) {	// try to split it between prefix and name.
+		const char *cp = name + nlen - 101;
+		while ((cp = strchr(cp + 1, '/'))) {
+			if (cp - name > 155) break;
+			if (cp[1] && strlen(cp + 1) <= 100) {
+				prefix = name;
+				plen = cp - name;
+				name = cp + 1;
+				break;
+			}
+		}
+		if (!prefix) writelong(fp, 'L', name);
+	}
+	if (link && strlen(link) > 100) writelong(fp, 'K', link);
+	char h[TAR_BLOCK];
+	memset(h, 0, TAR_BLOCK);
+	strncpy(h, name, 100);
+	octal(h + 100, 8, e->mode & 07777);
+	octal(h + 108, 8, e->uid);
+	octal(h + 116, 8, e->gid);
+	octal(h + 124, 12, size);
+	octal(h + 136, 12, (e->mtime < 0) ? 0 : e->mtime);
+	h[156] = type;
+	if (link) strncpy(h + 157, link, 100);
+	memcpy(h + 257, "ustar", 6);
+	memcpy(h + 263, "00", 2);
+	if (prefix) memcpy(h + 345, prefix, plen);
+	memset(h + 148, ' ', 8);
+	unsigned sum = 0;
+	size_t i;
+	for (i = 0; i < TAR_BLOCK; i++) sum += (unsigned char)h[i];
+	sprintf(h + 148, "%06o", sum);	// then NUL and the space left.
+	dowrite(fp, h, TAR_BLOCK);
+} // writeheader()
+
+static void
+writelong(FILE *fp, char type, const char *s)
+{ /* A GNU record holding the long name or link of the next member. */
+	tar_ent e;
+	memset(&e, 0, sizeof(tar_ent));
+	e.mode = 0644;
+	size_t len = strlen(s) + 1;
+	writeheader(fp, "././@LongLink", type, &e, len, NULL);
+	dowrite(fp, s, len);
+	writepad(fp, len);
+} // writelong()
+
+static void
+octal(char *field, size_t len, unsigned long long val)
+{ /* Put val in field as len - 1 octal digits and a NUL, or where it is
+   * too big for that, as big endian base 256 flagged by the top bit.
+*/
+	if (len < 2 || val >> (3 * (len - 1)) == 0) {
+		snprintf(field, len, "%0*llo", (int)(len - 1), val);
+		return;
+	}
+	size_t i;
+	for (i = len - 1; i > 0; i--) {
+		field[i] = val & 0xff;
+		val >>= 8;
+	}
+	field[0] = (char)0x80;
+} // octal()
+
+static void
+writedata(FILE *fp, int fd, off_t size, const char *path)
+{ /* Copy size bytes of the file open on fd, then the padding. */
+	char buf[64 * 1024];
+	off_t left = size;
+	while (left > 0) {
+		size_t want = (left < (off_t)sizeof(buf)) ? (size_t)left : sizeof(buf);
+		ssize_t got = read(fd, buf, want);
+		if (got == -1) {
+			if (errno == EINTR) continue;
+			perror(path);
+			got = 0;
+		}
+		if (got == 0) {	// shrunk since scanned, fill with zeros.
+			memset(buf, 0, want);
+			got = want;
+		}
+		dowrite(fp, buf, got);
+		left -= got;
+	}
+	writepad(fp, size);
+} // writedata()
+
+static void
+writepad(FILE *fp, off_t size)
+{ /* Zeros from the end of size bytes of data to the next block. */
+	static const char zeros[TAR_BLOCK];
+	size_t pad = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+	if (pad) dowrite(fp, zeros, pad);
+} // writepad()
+
+static void
+dowrite(FILE *fp, const void *buf, size_t len)
+{ /* fwrite() with error handling. */
+	if (fwrite(buf, 1, len, fp) != len) {
+		perror("write tarball");
+		exit(EXIT_FAILURE);
+	}
+} // dowrite()
@@ -0,0 +1,80 @@
+/*    tar.h
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of tar.[h|c] is to put a dir tree into one compressed
+ * tarball, as used for the dot dirs by -D. The tree is walked once, by
+ * tar_scan(), which also finds the newest change in it so that an
+ * unchanged tree need not be archived at all. tar_write() then streams
+ * ustar records, with GNU long name records where a name doesn't fit,
+ * into a pipe to pigz, or gzip if there is no pigz.
+ * */
+
+#ifndef _TAR_H
+#define _TAR_H
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <errno.h>
+#include "str.h"
+#include "dirs.h"
+#include "excl.h"
+
+typedef struct tar_ent {	// a member of the tarball to be.
+	char *name;			// relative to the base dir, in the arena.
+	mode_t mode;
+	uid_t uid;
+	gid_t gid;
+	off_t size;			// of a regular file, else 0.
+	time_t mtime;
+} tar_ent;
+
+typedef struct tar_list {
+	sarena *names;
+	tar_ent *ents;		// in the order found, dirs before their content.
+	size_t count, size;
+	long long bytes;	// total size of the regular files.
+	long long newest;	// latest mtime or ctime found, nanoseconds.
+} tar_list;
+
+tar_list
+*tar_scan(const char *base, const char *dir, excl_t *excl);
+
+void
+free_tarlist(tar_list *tl);
+
+FILE
+*tar_compressor(const char *path, pid_t *pid);
+
+void
+tar_endcompressor(FILE *fp, pid_t pid, const char *path);
+
+void
+tar_write(FILE *fp, tar_list *tl, const char *base);
+
+#endif
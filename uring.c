@@ -0,0 +1,301 @@
+/*    uring.c
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of uring.[h|c] is to batch the file system calls of the
+ * link stage through io_uring. See uring.h.
+ * */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "uring.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && HAVE_DECL_IORING_OP_LINKAT
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define UR_USABLE 1
+#endif
+
+#ifdef UR_USABLE
+
+struct ur_data {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned entries;
+	unsigned queued;	// in the ring, not yet submitted.
+	unsigned inflight;	// submitted, not yet reaped.
+	void *sqring, *cqring;
+	size_t sqlen, cqlen, sqeslen;
+};
+
+static int
+ur_enter(ur_data *ur, unsigned submit, unsigned wait);
+static struct io_uring_sqe
+*ur_getsqe(ur_data *ur);
+static void
+ur_reap(ur_data *ur);
+static int
+ur_probe(int fd);
+
+ur_data
+*init_uring(unsigned entries)
+{ /* Set up a ring of entries slots. Returns NULL if the kernel lacks
+   * io_uring, or any of the operations we need, so that the caller can
+   * fall back to the plain system calls.
+*/
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	int fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (fd == -1) return NULL;	// ENOSYS, EPERM when disabled etc.
+	if (!ur_probe(fd)) {
+		close(fd);
+		return NULL;
+	}
+	ur_data *ur = xmalloc(sizeof(ur_data));
+	memset(ur, 0, sizeof(ur_data));
+	ur->fd = fd;
+	ur->entries = p.sq_entries;
+	ur->sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ur->cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single) {
+		if (ur->cqlen > ur->sqlen) ur->sqlen = ur->cqlen;
+		ur->cqlen = ur->sqlen;
+	}
+	ur->sqring = mmap(NULL, ur->sqlen, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ur->sqring == MAP_FAILED) {
+		perror("mmap io_uring");
+		exit(EXIT_FAILURE);
+	}
+	ur->cqring = (single) ? ur->sqring
+				: mmap(NULL, ur->cqlen, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	ur->sqeslen = p.sq_entries * sizeof(struct io_uring_sqe);
+	ur->sqes = mmap(NULL, ur->sqeslen, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ur->cqring == MAP_FAILED || ur->sqes == MAP_FAILED) {
+		perror("mmap io_uring");
+		exit(EXIT_FAILURE);
+	}
+	char *sq = ur->sqring;
+	ur->sq_head = (unsigned *)(sq + p.sq_off.head);
+	ur->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ur->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	ur->sq_array = (unsigned *)(sq + p.sq_off.array);
+	char *cq = ur->cqring;
+	ur->cq_head = (unsigned *)(cq + p.cq_off.head);
+	ur->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ur->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return ur;
+} // init_uring()
+
+void
+free_uring(ur_data *ur)
+{ /* free resources allocated by init_uring() */
+	if (!ur) return;
+	ur_flush(ur);
+	munmap(ur->sqes, ur->sqeslen);
+	if (ur->cqring != ur->sqring) munmap(ur->cqring, ur->cqlen);
+	munmap(ur->sqring, ur->sqlen);
+	close(ur->fd);
+	free(ur);
+} // free_uring()
+
+void
+ur_statx(ur_data *ur, int dfd, const char *name, struct statx *stx,
+			int *res)
+{ /* Queue statx() of name in dfd, symlinks are not followed. */
+	struct io_uring_sqe *sqe = ur_getsqe(ur);
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = dfd;
+	sqe->addr = (unsigned long)name;
+	sqe->len = STATX_BASIC_STATS;
+	sqe->off = (unsigned long)stx;
+	sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+	sqe->user_data = (unsigned long)res;
+} // ur_statx()
+
+void
+ur_mkdirat(ur_data *ur, int dfd, const char *name, mode_t mode,
+			int *res)
+{ /* Queue mkdirat() of name in dfd. */
+	struct io_uring_sqe *sqe = ur_getsqe(ur);
+	sqe->opcode = IORING_OP_MKDIRAT;
+	sqe->fd = dfd;
+	sqe->addr = (unsigned long)name;
+	sqe->len = mode;
+	sqe->user_data = (unsigned long)res;
+} // ur_mkdirat()
+
+void
+ur_linkat(ur_data *ur, int frofd, const char *fro, int tofd,
+			const char *to, int *res)
+{ /* Queue linkat() of fro in frofd to to in tofd. */
+	struct io_uring_sqe *sqe = ur_getsqe(ur);
+	sqe->opcode = IORING_OP_LINKAT;
+	sqe->fd = frofd;
+	sqe->addr = (unsigned long)fro;
+	sqe->len = tofd;
+	sqe->addr2 = (unsigned long)to;
+	sqe->hardlink_flags = 0;
+	sqe->user_data = (unsigned long)res;
+} // ur_linkat()
+
+void
+ur_flush(ur_data *ur)
+{ /* Submit everything queued and wait until every result is in. */
+	while (ur->queued || ur->inflight) {
+		unsigned submit = ur->queued;
+		int done = ur_enter(ur, submit, ur->inflight + submit);
+		ur->queued -= done;
+		ur->inflight += done;
+		ur_reap(ur);
+	}
+} // ur_flush()
+
+static struct io_uring_sqe
+*ur_getsqe(ur_data *ur)
+{ /* Return a cleared slot at the tail of the submission ring, flushing
+   * first if the ring is full. The completion ring is at least twice
+   * the size of the submission ring so it can't overflow.
+*/
+	if (ur->queued + ur->inflight >= ur->entries) ur_flush(ur);
+	unsigned tail = *ur->sq_tail;
+	unsigned idx = tail & *ur->sq_mask;
+	struct io_uring_sqe *sqe = &ur->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	ur->sq_array[idx] = idx;
+	__atomic_store_n(ur->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ur->queued++;
+	return sqe;
+} // ur_getsqe()
+
+static int
+ur_enter(ur_data *ur, unsigned submit, unsigned wait)
+{ /* io_uring_enter() with error handling, returns number submitted. */
+	while (1) {
+		int res = syscall(__NR_io_uring_enter, ur->fd, submit, wait,
+							IORING_ENTER_GETEVENTS, NULL, 0);
+		if (res >= 0) return res;
+		if (errno == EINTR) continue;
+		if (errno == EAGAIN || errno == EBUSY) {	// reap, then retry.
+			ur_reap(ur);
+			continue;
+		}
+		perror("io_uring_enter");
+		exit(EXIT_FAILURE);
+	}
+} // ur_enter()
+
+static void
+ur_reap(ur_data *ur)
+{ /* Hand out every result waiting in the completion ring. */
+	unsigned head = *ur->cq_head;
+	unsigned tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		struct io_uring_cqe *cqe = &ur->cqes[head & *ur->cq_mask];
+		int *res = (int *)(unsigned long)cqe->user_data;
+		if (res) *res = cqe->res;
+		head++;
+		ur->inflight--;
+	}
+	__atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+} // ur_reap()
+
+static int
+ur_probe(int fd)
+{ /* Return 1 if the kernel supports every operation we issue. */
+	size_t len = sizeof(struct io_uring_probe)
+				+ 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = xmalloc(len);
+	memset(probe, 0, len);
+	int ok = 0;
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+				probe, 256) == 0) {
+		int ops[] = { IORING_OP_STATX, IORING_OP_MKDIRAT,
+						IORING_OP_LINKAT };
+		size_t i;
+		ok = 1;
+		for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+			if (ops[i] > probe->last_op ||
+				!(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+				ok = 0;
+		}
+	}
+	free(probe);
+	return ok;
+} // ur_probe()
+
+#else	/* no usable io_uring at build time */
+
+struct ur_data {
+	int unused;
+};
+
+ur_data
+*init_uring(unsigned entries)
+{ /* io_uring was not available when this was built. */
+	(void)entries;
+	return NULL;
+} // init_uring()
+
+void
+free_uring(ur_data *ur)
+{
+	(void)ur;
+} // free_uring()
+
+void
+ur_statx(ur_data *ur, int dfd, const char *name, struct statx *stx,
+			int *res)
+{ /* never called, init_uring() never succeeds. */
+	(void)ur; (void)dfd; (void)name; (void)stx; (void)res;
+	abort();
+} // ur_statx()
+
+void
+ur_mkdirat(ur_data *ur, int dfd, const char *name, mode_t mode,
+			int *res)
+{
+	(void)ur; (void)dfd; (void)name; (void)mode; (void)res;
+	abort();
+} // ur_mkdirat()
+
+void
+ur_linkat(ur_data *ur, int frofd, const char *fro, int tofd,
+			const char *to, int *res)
+{
+	(void)ur; (void)frofd; (void)fro; (void)tofd; (void)to; (void)res;
+	abort();
+} // ur_linkat()
+
+void
+ur_flush(ur_data *ur)
+{
+	(void)ur;
+} // ur_flush()
+
+#endif
@@ -0,0 +1,68 @@
+/*    uring.h
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of uring.[h|c] is to batch the file system calls of the
+ * link stage through io_uring, using the raw system calls so that no
+ * extra library is needed. Only statx, mkdirat and linkat are provided
+ * since those are what the linker issues per entry. The kernel has no
+ * io_uring getdents so dirs are still read with getdents64().
+ *
+ * Each queued operation carries a pointer to an int that receives its
+ * result, 0 or -errno, when ur_flush() returns. Until then the names
+ * and buffers given must stay put.
+ * */
+
+#ifndef _URING_H
+#define _URING_H
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "str.h"
+
+typedef struct ur_data ur_data;
+
+ur_data
+*init_uring(unsigned entries);
+
+void
+free_uring(ur_data *ur);
+
+void
+ur_statx(ur_data *ur, int dfd, const char *name, struct statx *stx,
+			int *res);
+
+void
+ur_mkdirat(ur_data *ur, int dfd, const char *name, mode_t mode,
+			int *res);
+
+void
+ur_linkat(ur_data *ur, int frofd, const char *fro, int tofd,
+			const char *to, int *res);
+
+void
+ur_flush(ur_data *ur);
+
+#endif
@@ -0,0 +1,367 @@
+/*    watch.c
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of watch.[h|c] is to keep the target in step with the
+ * source as changes happen, using an inotify watch on every source
+ * dir, instead of waiting for the next full run.
+ * */
+
+#include "watch.h"
+
+static const uint32_t wtmask = IN_CREATE | IN_CLOSE_WRITE | IN_DELETE
+						| IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR
+						| IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+static volatile sig_atomic_t wt_stop;
+static volatile sig_atomic_t wt_hup;
+
+static void
+addwatch(wt_data *wt, const char *src, char **dsts, int isroot);
+static void
+watchtree(wt_data *wt, const char *src, char **dsts);
+static char
+**dupdsts(wt_data *wt, char **dsts, const char *tail);
+static void
+freedsts(wt_data *wt, char **dsts);
+static void
+unwatchtree(wt_data *wt, const char *src);
+static void
+dropwatch(wt_data *wt, int wd);
+static void
+doevent(wt_data *wt, struct inotify_event *ev);
+static void
+onstop(int sig);
+static void
+onhup(int sig);
+static void
+reload(wt_data *wt);
+
+wt_data
+*init_watch(lk_data *lk, rd_data *rd)
+{ /* Prepare to watch. Rd supplies the excludes and the number of
+   * threads to use when reading a new tree, it must list DT_DIR only.
+*/
+	wt_data *wt = xmalloc(sizeof(wt_data));
+	memset(wt, 0, sizeof(wt_data));
+	wt->ifd = inotify_init1(IN_CLOEXEC);
+	if (wt->ifd == -1) {
+		perror("inotify_init1");
+		exit(EXIT_FAILURE);
+	}
+	wt->lk = lk;
+	wt->rd = rd;
+	wt->ntargets = lk->ntargets;
+	return wt;
+} // init_watch()
+
+void
+free_watch(wt_data *wt)
+{ /* free resources allocated by init_watch() and the wt_*() */
+	size_t i;
+	for (i = 0; i < wt->size; i++) {
+		if (wt->dirs[i]) dropwatch(wt, i);
+	}
+	for (i = 0; i < wt->ntrees; i++) {
+		free(wt->tsrc[i]);
+		freedsts(wt, wt->tdst[i]);
+	}
+	free(wt->dirs);
+	free(wt->tsrc);
+	free(wt->tdst);
+	freedsts(wt, wt->cloud);
+	freedsts(wt, wt->dotdirs);
+	close(wt->ifd);
+	free(wt);
+} // free_watch()
+
+void
+wt_root(wt_data *wt, const char *root, char **cloud, char **dotdirs)
+{ /* Watch root, the source dir, so that new top level dirs get linked
+   * to the cloud dirs, or to the dot dirs dirs, as they appear. Each
+   * has one dir per target. Dotdirs is NULL when the dot dirs are
+   * tarballed, not linked.
+*/
+	wt->cloud = dupdsts(wt, cloud, NULL);
+	wt->dotdirs = (dotdirs) ? dupdsts(wt, dotdirs, NULL) : NULL;
+	addwatch(wt, root, NULL, 1);
+} // wt_root()
+
+void
+wt_addtree(wt_data *wt, const char *src, char **dsts)
+{ /* Watch every dir under src, which is already mirrored at dsts. */
+	wt->tsrc = realloc(wt->tsrc, (wt->ntrees + 1) * sizeof(char *));
+	wt->tdst = realloc(wt->tdst, (wt->ntrees + 1) * sizeof(char **));
+	if (!wt->tsrc || !wt->tdst) {
+		fputs("Out of memory.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	wt->tsrc[wt->ntrees] = xstrdup((char *)src);
+	wt->tdst[wt->ntrees] = dupdsts(wt, dsts, NULL);
+	wt->ntrees++;
+	watchtree(wt, src, dsts);
+} // wt_addtree()
+
+void
+wt_run(wt_data *wt)
+{ /* Read and act on events until SIGINT or SIGTERM arrives. SIGHUP
+   * reloads the config file.
+*/
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = onstop;	// no SA_RESTART so read() gets EINTR.
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = onhup;
+	sigaction(SIGHUP, &sa, NULL);
+	char buf[64 * 1024]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	while (!wt_stop) {
+		if (wt_hup) reload(wt);
+		ssize_t len = read(wt->ifd, buf, sizeof(buf));
+		if (len == -1) {
+			if (errno == EINTR) continue;
+			perror("read inotify");
+			exit(EXIT_FAILURE);
+		}
+		char *cp = buf;
+		while (cp < buf + len) {
+			struct inotify_event *ev = (struct inotify_event *)cp;
+			doevent(wt, ev);
+			cp += sizeof(struct inotify_event) + ev->len;
+		}
+		fflush(stdout);
+	}
+} // wt_run()
+
+static void
+reload(wt_data *wt)
+{ /* Act on SIGHUP, outside the signal handler. */
+	wt_hup = 0;
+	if (!wt->cfg) return;
+	if (cfg_reload(wt->cfg) == -1) {
+		fprintf(stderr, "Kept the old settings of %s\n", wt->cfg->path);
+		return;
+	}
+	long long n;
+	int res = cfg_trynum(wt->cfg, "threads", &n);
+	if (res == -1) {	// a bad edit, not worth dying for.
+		fprintf(stderr, "%s: threads is not a number, kept %d\n",
+					wt->cfg->path, wt->rd->nthreads);
+	} else if (res == 1 && !wt->fixthreads && n > 0) {
+		wt->rd->nthreads = n;
+	}
+	printf("Reloaded %s\n", wt->cfg->path);
+	fflush(stdout);
+} // reload()
+
+static void
+doevent(wt_data *wt, struct inotify_event *ev)
+{ /* Make the target match the source after one event. */
+	if (ev->mask & IN_Q_OVERFLOW) {	// events lost, resync everything.
+		fputs("inotify queue overflow, resyncing.\n", stderr);
+		size_t i;
+		for (i = 0; i < wt->ntrees; i++) {
+			if (exists_dir(wt->tsrc[i]))
+				synctree(wt->tsrc[i], wt->tdst[i], wt->lk);
+		}
+		return;
+	}
+	if (ev->wd < 0 || (size_t)ev->wd >= wt->size) return;
+	wt_dir *wd = wt->dirs[ev->wd];
+	if (!wd) return;
+	if (ev->mask & IN_IGNORED) {	// dir gone or watch removed.
+		dropwatch(wt, ev->wd);
+		return;
+	}
+	if (!ev->len) return;
+	int isdir = (ev->mask & IN_ISDIR) != 0;
+	char src[PATH_MAX];
+	strcpy(src, wd->src);
+	strjoin(src, '/', ev->name, PATH_MAX);
+	char **parents = wd->dst;
+	size_t k;
+	if (wd->isroot) {	// only dirs are linked from the top level.
+		if (!isdir) return;
+		if (ev->name[0] == '.' && !wt->dotdirs) return;
+		parents = (ev->name[0] == '.') ? wt->dotdirs : wt->cloud;
+		for (k = 0; k < wt->ntargets; k++) {
+			if (strcmp(src, wt->cloud[k]) == 0) return;
+		}
+	}
+	if (isdir && excluded(wt->rd->excl, src)) return;
+	char tail[NAME_MAX + 2];
+	snprintf(tail, sizeof(tail), "/%s", ev->name);
+	char **dst = dupdsts(wt, parents, tail);
+	/* A file is linked when it is made, before it is written, which is
+	 * all a link needs. A copy must be made again once the writer is
+	 * done; copyin() skips it if the writer changed nothing. */
+	if (ev->mask & (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE)) {
+		if (isdir) {
+			for (k = 0; k < wt->ntargets; k++) newdir(dst[k], 1);
+			/* Watch before linking so nothing made meanwhile is missed. */
+			if (wd->isroot) {
+				wt_addtree(wt, src, dst);
+			} else {
+				watchtree(wt, src, dst);
+			}
+			synctree(src, dst, wt->lk);
+		} else {
+			struct stat sb;
+			if (lstat(src, &sb) == 0 && S_ISREG(sb.st_mode)) {
+				linkpath(src, dst, wt->lk);
+			}
+		}
+	} else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+		if (isdir && (ev->mask & IN_MOVED_FROM)) unwatchtree(wt, src);
+		for (k = 0; k < wt->ntargets; k++) {
+			struct stat sb;
+			if (isdir) {
+				rmtree(dst[k]);
+				printf("Removed: %s\n", dst[k]);
+			} else if (lstat(dst[k], &sb) == 0 && S_ISREG(sb.st_mode)) {
+				if (unlink(dst[k]) == -1) {
+					perror(dst[k]);
+				} else {
+					printf("Removed: %s\n", dst[k]);
+				}
+			}
+		}
+	}
+	freedsts(wt, dst);
+} // doevent()
+
+static void
+watchtree(wt_data *wt, const char *src, char **dsts)
+{ /* Watch src and every dir under it. Dsts are the targets of src. */
+	addwatch(wt, src, dsts, 0);
+	sarena *sa = init_sarena(wt->rd->meminc);
+	recursedir_mt((char *)src, sa, wt->rd);
+	size_t slen = strlen(src);
+	size_t i;
+	for (i = 0; i < sa->count; i++) {
+		char **sub = dupdsts(wt, dsts, sa->index[i] + slen);
+		addwatch(wt, sa->index[i], sub, 0);
+		freedsts(wt, sub);
+	}
+	free_sarena(sa);
+} // watchtree()
+
+static void
+unwatchtree(wt_data *wt, const char *src)
+{ /* Stop watching src and every dir under it, needed when a dir moves
+   * out of the watched tree. Dropping them at once, not when IN_IGNORED
+   * comes, keeps the stale paths from being acted on meanwhile.
+*/
+	size_t slen = strlen(src);
+	size_t i;
+	for (i = 0; i < wt->size; i++) {
+		wt_dir *wd = wt->dirs[i];
+		if (!wd) continue;
+		if (strncmp(wd->src, src, slen) != 0) continue;
+		if (wd->src[slen] != 0 && wd->src[slen] != '/') continue;
+		inotify_rm_watch(wt->ifd, i);
+		dropwatch(wt, i);
+	}
+} // unwatchtree()
+
+static void
+addwatch(wt_data *wt, const char *src, char **dsts, int isroot)
+{ /* Add a watch on src and record what it's mirrored to. */
+	int wd = inotify_add_watch(wt->ifd, src, wtmask);
+	if (wd == -1) {
+		if (errno == ENOENT || errno == ENOTDIR) return;	// gone.
+		if (errno == ENOSPC) {
+			if (!wt->nospace) {
+				fputs("Out of inotify watches, raise "
+				"/proc/sys/fs/inotify/max_user_watches.\n", stderr);
+			}
+			wt->nospace = 1;
+			return;
+		}
+		perror(src);
+		exit(EXIT_FAILURE);
+	}
+	if ((size_t)wd >= wt->size) {
+		size_t newsize = (wt->size) ? wt->size : 1024;
+		while (newsize <= (size_t)wd) newsize *= 2;
+		wt->dirs = realloc(wt->dirs, newsize * sizeof(wt_dir *));
+		if (!wt->dirs) {
+			fputs("Out of memory.\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		memset(wt->dirs + wt->size, 0,
+				(newsize - wt->size) * sizeof(wt_dir *));
+		wt->size = newsize;
+	}
+	if (wt->dirs[wd]) dropwatch(wt, wd);	// same dir, new name.
+	wt_dir *d = xmalloc(sizeof(wt_dir));
+	d->src = xstrdup((char *)src);
+	d->dst = (dsts) ? dupdsts(wt, dsts, NULL) : NULL;
+	d->isroot = isroot;
+	wt->dirs[wd] = d;
+} // addwatch()
+
+static void
+dropwatch(wt_data *wt, int wd)
+{ /* Forget the record of a watch. */
+	wt_dir *d = wt->dirs[wd];
+	free(d->src);
+	freedsts(wt, d->dst);
+	free(d);
+	wt->dirs[wd] = NULL;
+} // dropwatch()
+
+static char
+**dupdsts(wt_data *wt, char **dsts, const char *tail)
+{ /* Return a copy of dsts, one path per target, with tail, if not
+   * NULL, appended to each.
+*/
+	char **ret = xmalloc(wt->ntargets * sizeof(char *));
+	size_t k;
+	for (k = 0; k < wt->ntargets; k++) {
+		char buf[PATH_MAX];
+		strcpy(buf, dsts[k]);
+		if (tail) strjoin(buf, 0, (char *)tail, PATH_MAX);
+		ret[k] = xstrdup(buf);
+	}
+	return ret;
+} // dupdsts()
+
+static void
+freedsts(wt_data *wt, char **dsts)
+{ /* free a list made by dupdsts(), may be NULL */
+	if (!dsts) return;
+	size_t k;
+	for (k = 0; k < wt->ntargets; k++) free(dsts[k]);
+	free(dsts);
+} // freedsts()
+
+static void
+onstop(int sig)
+{ /* Signal handler, ends wt_run(). */
+	(void)sig;
+	wt_stop = 1;
+} // onstop()
+
+static void
+onhup(int sig)
+{ /* Signal handler, asks wt_run() to reload the config. */
+	(void)sig;
+	wt_hup = 1;
+} // onhup()
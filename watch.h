@@ -0,0 +1,83 @@
+/*    watch.h
+ *
+ * Copyright 2018 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* The purpose of watch.[h|c] is to keep the target in step with the
+ * source as changes happen, using an inotify watch on every source
+ * dir, instead of waiting for the next full run.
+ * */
+
+#ifndef _WATCH_H
+#define _WATCH_H
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <errno.h>
+#include "str.h"
+#include "dirs.h"
+#include "files.h"
+#include "linker.h"
+#include "cfg.h"
+
+typedef struct wt_dir {	// a watched source dir.
+	char *src;
+	char **dst;			// where it is mirrored, one per target.
+	int isroot;			// only new top level dirs matter here.
+} wt_dir;
+
+typedef struct wt_data {
+	int ifd;			// the inotify instance.
+	wt_dir **dirs;		// indexed by watch descriptor.
+	size_t size;
+	lk_data *lk;
+	rd_data *rd;		// excludes and threads for seeding watches.
+	size_t ntargets;	// the cloud targets, as lk->ntargets.
+	char **cloud;		// targets of top level dirs.
+	char **dotdirs;		// targets of top level dot dirs, NULL if not linked.
+	char **tsrc, ***tdst;	// trees to resync if events are lost.
+	size_t ntrees;
+	int nospace;		// inotify watch limit has been hit.
+	cfg_t *cfg;			// reloaded on SIGHUP, may be NULL.
+	int fixthreads;		// rd->nthreads was given by -j, keep it.
+} wt_data;
+
+wt_data
+*init_watch(lk_data *lk, rd_data *rd);
+
+void
+free_watch(wt_data *wt);
+
+void
+wt_root(wt_data *wt, const char *root, char **cloud, char **dotdirs);
+
+void
+wt_addtree(wt_data *wt, const char *src, char **dsts);
+
+void
+wt_run(wt_data *wt);
+
+#endif